@@ -1,6 +1,10 @@
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <stdarg.h>
 
 #if defined(_MSC_VER)
 #include <windows.h>
@@ -19,11 +23,28 @@
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_mixer.h>
 #include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #include <iniparser.h>
 
 #endif
 
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 #define RAD_TO_DEG(x) ((x) * 180.0 / M_PI)
 #define DEG_TO_RAD(x) ((x) * M_PI / 180.0)
 
@@ -38,6 +59,24 @@ typedef struct {
 	float x, y;
 } float2;
 
+/**
+ * Fixed point numbers of the deterministic simulation, see fx_init().
+ * Lengths, velocities, accelerations, angles and sine values are Q16
+ * (16 fractional bits), durations are Q24.
+ **/
+typedef int64_t fixed_t;
+
+#define FX_SHIFT       16
+#define FX_ONE         ((fixed_t)1 << FX_SHIFT)
+#define FX(v)          ((fixed_t)((v) * FX_ONE))
+#define FX_MUL(a, b)   (((a) * (b)) >> FX_SHIFT)
+#define FX_TIME_SHIFT  24
+#define FX_TIME(v)     ((fixed_t)((v) * ((fixed_t)1 << FX_TIME_SHIFT)))
+
+typedef struct {
+	fixed_t x, y;
+} fixed2;
+
 typedef struct {
 	SDL_Color color;
 	int protectors[24];
@@ -46,36 +85,85 @@ typedef struct {
 	int lifepoints;
 } base_t;
 
-typedef struct particle {
-	base_t const * base;
-	int x, y;
-	float rotation;
-	int progress;
-	struct particle * next;
-} particle_t;
+/**
+ * A projectile remembers its position of the last TRAIL_LENGTH ticks,
+ * the trail is drawn as one fading ribbon through them.
+ **/
+#define TRAIL_LENGTH 100
+#define TRAIL_WIDTH  11
 
 typedef struct projectile {
 	base_t const * base;
 	bool active;
 	float2 pos;
+	float2 prevPos;
 	float2 vel;
+	float2 acc;
+	fixed2 fxPos; // only used by the fixed point simulation
+	fixed2 fxVel;
+	fixed2 fxAcc;
+	float2 trail[TRAIL_LENGTH]; // ring buffer, trailHead is the newest position
+	int trailHead;
+	int trailCount;
+	int trailTick; // tick of the newest position
+	int id; // in the order the projectiles of a turn were fired
+	int spectateId; // the viewers know it by, -1 if not yet
 	struct projectile * next;
 } projectile_t;
 
 typedef struct affector {
-	int type; /* -1=removed, 0=positive, 1=negative, 2=boost, 3=splitter3, 4=splitter2 */
+	int type; /* 0=positive, 1=negative, 2=boost, 3=splitter3, 4=splitter2 */
 	base_t const * owner; 
 	float2 center;
 	float rotation;
 	int lifepoints;
-	struct affector *next;
+	fixed2 fxCenter; // copies for the fixed point simulation, set at the launch
+	fixed_t fxRotation;
+	int slot; // handle slot, see affector_handle()
 } affector_t;
 
+/**
+ * Refers to an affector across removals of other affectors.
+ **/
+typedef int affector_handle_t;
+
+#define AFFECTOR_NONE ((affector_handle_t)-1)
+
 typedef struct block {
 	SDL_Rect rect;
 	struct block *next;
 } block_t;
 
+#define TURN_MAX_AFFECTORS 255
+
+typedef struct {
+	uint8_t type;
+	uint16_t lifepoints;
+	int16_t x, y;
+	int16_t rotation; // 1/100 degree
+} turn_affector_t;
+
+/**
+ * Everything a player decided in one turn.
+ **/
+typedef struct {
+	int winner;      // 0 = none, 1 = left base, 2 = right base
+	int turns;
+	int desyncTurn;  // first turn with a different state or battle hash, -1 if none
+	int desyncTick;  // first tick of that battle that differs, -1 if the turn already started differently
+	int lifepoints[2];
+	int protectors[2][24];
+} replay_result_t;
+
+typedef struct {
+	uint32_t hash;  // state hash at the start of the turn
+	int32_t angle;  // launch angle in 1/1000 degree
+	uint32_t time;  // battleTime at launch in milliseconds
+	uint8_t resources[AFFECTOR_TYPE_COUNT];
+	int count;
+	turn_affector_t affectors[TURN_MAX_AFFECTORS];
+} turn_t;
+
 SDL_Window *window;
 SDL_Renderer *renderer;
 
@@ -118,43 +206,104 @@ SDL_Texture *texCredits;
 SDL_Texture *texFinalBlue;
 SDL_Texture *texFinalGreen;
 
-Mix_Chunk *sndStartup;
-Mix_Chunk *sndLaunch;
-Mix_Chunk *sndSplit2;
-Mix_Chunk *sndSplit3;
-Mix_Chunk *sndBoost;
-Mix_Chunk *sndImpactBarricade;
-Mix_Chunk *sndImpactBase;
-Mix_Chunk *sndImpactWall;
+/**
+ * Sound effects
+ **/
+#define SND_STARTUP          0
+#define SND_LAUNCH           1
+#define SND_SPLIT2           2
+#define SND_SPLIT3           3
+#define SND_BOOST            4
+#define SND_IMPACT_BARRICADE 5
+#define SND_IMPACT_BASE      6
+#define SND_IMPACT_WALL      7
+#define SND_COUNT            8
+
+Mix_Chunk *sounds[SND_COUNT];
+
+bool audioEnabled = false;
 
 
 int cooldowns[AFFECTOR_TYPE_COUNT] = AFFECTOR_COOLDOWNS;
 
 bool isGameRunning = false;
 
-struct {
+/**
+ * The simulation state is thread local, so headless simulations
+ * (e.g. replay verification) can run on worker threads.
+ **/
+typedef struct {
 	bool useSlowAiming;
 	bool affectorsStay;
 	bool rotatingProtectors;
 	int affectorLifespan;
 	int protectorLifespan;
 	int baseLifespan;
-} gameOptions = {
+	bool fixedPoint;
+	int fieldTheta; // Barnes-Hut opening angle in 1/1000, 0 sums the field exactly
+} game_options_t;
+
+THREAD_LOCAL game_options_t gameOptions = {
 	/* useSlowAiming      = */ false,
 	/* affectorsStay      = */ false, 
 	/* rotatingProtectors = */ false,
 	/* affectorLifespan   = */ 3, // 0-...
 	/* protectorLifespan  = */ 3, // 0-3
 	/* baseLifespan       = */ 4, // 1-10
+	/* fixedPoint         = */ false,
+	/* fieldTheta         = */ 0,
 };
 
-float battleTime = 0.0;
-#define PROTECTOR_ROTSPEED (gameOptions.rotatingProtectors ? 2.0 : 0.0)
-#define PROTECTOR_OFFSET (battleTime * PROTECTOR_ROTSPEED)
+/**
+ * The simulation always runs with SIM_RATE ticks per second, independent
+ * of the display. battleTime is the game time in seconds, renderAlpha
+ * is the fraction of a tick the renderer interpolates into.
+ **/
+#define SIM_RATE 60
+#define SIM_DT (1.0 / SIM_RATE)
+#define MAX_FRAME_TIME 0.25
+
+THREAD_LOCAL float battleTime = 0.0;
+THREAD_LOCAL int battleTicks = 0;
+THREAD_LOCAL int battleProjectiles = 0; // fired this turn
+THREAD_LOCAL int battleWallHits = 0;
+THREAD_LOCAL int battleStartMs = 0; // battleTime at the launch, in ms
+THREAD_LOCAL uint32_t battleHash = 0; // rolling hash of the battle, see battle_hash()
+float renderAlpha = 1.0;
 
-int framecounter = 0;
+/**
+ * Time spent in each pass of the renderer, only measured while
+ * renderProfiling is set (see render_pass_end()).
+ **/
+#define RENDER_PASS_OTHER       0
+#define RENDER_PASS_BACKGROUND  1
+#define RENDER_PASS_BASES       2
+#define RENDER_PASS_BLOCKS      3
+#define RENDER_PASS_PROTECTORS  4
+#define RENDER_PASS_TRAILS      5
+#define RENDER_PASS_PROJECTILES 6
+#define RENDER_PASS_AFFECTORS   7
+#define RENDER_PASS_PANELS      8
+#define RENDER_PASS_COUNT       9
+
+bool renderProfiling = false;
+uint64_t renderPassStart = 0;
+uint64_t renderPassTime[RENDER_PASS_COUNT];
+#define PROTECTOR_ROTSPEED (gameOptions.rotatingProtectors ? 4.0 : 0.0)
+#define PROTECTOR_ANGLE(t) ((t) * PROTECTOR_ROTSPEED)
+#define PROTECTOR_OFFSET PROTECTOR_ANGLE(battleTime)
+
+#define SHIELD_ROTSPEED_LEFT   7.5
+#define SHIELD_ROTSPEED_RIGHT -10.0
 
-base_t leftBase = {
+/**
+ * Simulation ticks per rendered frame while the battle plays.
+ * simulateEffects is false while a turn is resolved instantly.
+ **/
+int battleSpeed = 1;
+THREAD_LOCAL bool simulateEffects = true;
+
+THREAD_LOCAL base_t leftBase = {
 	{ 92, 75, 255, 255 },
 	{ 0 },
 	{ 0 },
@@ -162,7 +311,7 @@ base_t leftBase = {
 	0
 };
 
-base_t rightBase = {
+THREAD_LOCAL base_t rightBase = {
 	{ 85, 182, 74, 255 },
 	{ 0 },
 	{ 0 },
@@ -170,10 +319,135 @@ base_t rightBase = {
 	0
 };
 
-particle_t *particles = NULL;
-projectile_t *projectiles = NULL;
-affector_t *affectors = NULL;
-block_t *blockchain = NULL;
+THREAD_LOCAL projectile_t *projectiles = NULL;
+/**
+ * The affectors of a match, densely packed in affectors[0..affectorCount).
+ * Removing an affector moves the last one into its place, so the order
+ * changes and pointers are only valid until the next removal. Code that
+ * has to hold on to an affector (e.g. the build UI) uses a handle.
+ **/
+#define AFFECTOR_MAX        4096
+#define AFFECTOR_SLOT_BITS  12 // log2(AFFECTOR_MAX)
+
+typedef struct {
+	int index;      // into affectors, -1 if the slot is unused
+	int generation; // incremented whenever the affector of the slot is removed
+} affector_slot_t;
+
+THREAD_LOCAL affector_t *affectors = NULL;
+THREAD_LOCAL int affectorCount = 0;
+THREAD_LOCAL affector_slot_t *affectorSlots = NULL;
+THREAD_LOCAL int *affectorFreeSlots = NULL;
+THREAD_LOCAL int affectorFreeSlotCount = 0;
+
+/**
+ * Barnes-Hut tree over the field affectors, for gameOptions.fieldTheta > 0.
+ * Every cell is split into four quadrants until at most FIELD_TREE_LEAF
+ * affectors are left. Cells are split on fixed point coordinates, so the
+ * tree has the same shape on every machine. The affectors of each sign
+ * (pulling, pushing) in a cell are summarized by their number and centroid.
+ **/
+#define FIELD_TREE_LEAF  8
+#define FIELD_TREE_DEPTH 16
+#define FIELD_TREE_NODES (2 * AFFECTOR_MAX) // cells become leaves when they run out
+
+typedef struct {
+	fixed2 min;        // Q16, from the partition keys
+	fixed_t size;
+	int first, count;  // affectors in order[first..first+count)
+	int children[4];   // -1 if the quadrant is empty
+	bool leaf;
+	int mass[2];
+	float2 center[2];
+	fixed2 fxCenter[2];
+} field_node_t;
+
+/**
+ * Packed copies of the affectors for the simulation, see affector_pack().
+ * The field affectors (positive and negative) with the sign of their
+ * force, and the centers of all affectors for the contact test.
+ **/
+typedef struct {
+	bool valid;
+	int fieldCount;
+	float *fieldX, *fieldY;
+	float *fieldSign; // -1 pulls, +1 pushes
+	fixed_t *fxFieldX, *fxFieldY;
+	fixed_t *fxFieldSign;
+	int count; // same order as affectors
+	float *x, *y;
+	fixed_t *fxX, *fxY;
+	
+	field_node_t *nodes; // only built if gameOptions.fieldTheta > 0
+	int nodeCount;
+	int *order;          // field affectors, grouped by node
+	int *scratch;
+} affector_pack_t;
+
+THREAD_LOCAL affector_pack_t affectorPack;
+THREAD_LOCAL block_t *blockchain = NULL;
+THREAD_LOCAL int levelVersion = 0; // changes with every set_level()
+
+/**
+ * Region allocator. Objects are bump allocated out of chunks and released
+ * all at once with arena_reset. The chunks are kept for the next use of
+ * the arena, so a running game reuses the same memory over and over.
+ *
+ * There is an arena per lifetime:
+ *   level: the blocks of the level
+ *   match: the affector array and its handle slots
+ *   turn:  projectiles
+ **/
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 8
+
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	size_t used;
+	size_t size;
+	double data[];
+} arena_chunk_t;
+
+typedef struct {
+	const char *name;
+	arena_chunk_t *chunks;
+	arena_chunk_t *current;
+	int allocations;       // since the last reset
+	size_t bytes;          // since the last reset
+	long totalAllocations;
+	size_t peakBytes;
+	size_t reserved;
+	int resets;
+} arena_t;
+
+THREAD_LOCAL arena_t levelArena = { "level" };
+THREAD_LOCAL arena_t matchArena = { "match" };
+THREAD_LOCAL arena_t turnArena = { "turn" };
+
+/**
+ * Random numbers (PCG32, see rng_next()).
+ * Every match has a seed, which the host sends to the other player and
+ * replays record, and every kind of randomness its own stream of it:
+ * gameplayRng must be drawn the same way on every machine, cosmeticRng is
+ * for effects that don't change the game state and botRng for the
+ * decisions of bot_build(), which only run on one machine.
+ **/
+typedef struct {
+	uint64_t state;
+	uint64_t inc;
+} rng_t;
+
+#define RNG_STREAM_GAMEPLAY 1
+#define RNG_STREAM_COSMETIC 2
+#define RNG_STREAM_BOT      3
+
+THREAD_LOCAL uint32_t matchSeed = 0;
+THREAD_LOCAL rng_t gameplayRng;
+THREAD_LOCAL rng_t cosmeticRng;
+THREAD_LOCAL rng_t botRng;
+
+
+bool printMemoryStats = false;
 
 SDL_Rect battleground = {
 	128, 0,
@@ -183,6 +457,20 @@ SDL_Rect battleground = {
 float distance(float2 a, float2 b);
 float length(float2 a);
 
+void fx_init();
+fixed_t fx_sin(fixed_t degrees);
+fixed_t fx_cos(fixed_t degrees);
+fixed_t fx_length(fixed2 v);
+fixed_t fx_distance(fixed2 a, fixed2 b);
+fixed2 fx_from_float2(float2 v);
+float2 fx_to_float2(fixed2 v);
+bool fx_check_collision(
+	fixed2 start,
+	fixed2 end,
+	fixed2 center,
+	fixed2 size,
+	fixed_t rot);
+
 // Returns 1 if the lines intersect, otherwise 0. In addition, if the lines 
 // intersect the intersection point may be stored in the floats i_x and i_y.
 bool get_line_intersection(
@@ -198,26 +486,462 @@ bool check_collision(
 
 void load_resources();
 
+void audio_init();
+
+void audio_emit(int snd);
+
+void audio_flush();
+
+/**
+ * Logging, see log_write().
+ * Levels below LOG_COMPILE_LEVEL are removed at compile time, levels
+ * below logLevel (game.ini "logLevel") at run time.
+ **/
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+#if !defined(LOG_COMPILE_LEVEL)
+#if defined(NDEBUG)
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) log_write(LOG_LEVEL_DEBUG, __func__, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...)  log_write(LOG_LEVEL_INFO, __func__, __VA_ARGS__)
+#else
+#define LOG_INFO(...)  ((void)0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...)  log_write(LOG_LEVEL_WARN, __func__, __VA_ARGS__)
+#else
+#define LOG_WARN(...)  ((void)0)
+#endif
+#define LOG_ERROR(...) log_write(LOG_LEVEL_ERROR, __func__, __VA_ARGS__)
+
+int logLevel = LOG_LEVEL_INFO;
+char logFile[256] = "";
+
+void log_init();
+
+void log_start();
+
+void log_write(int level, const char *func, const char *format, ...);
+
 void menu();
 
+void render_menu(int selection);
+
+void render_level_selection(int selection);
+
+void render_battleground();
+
+void render_tool_panels(base_t const *player);
+
+void render_aim_preview(base_t const *player, float angle);
+
+void render_selection(affector_t const *a, bool isRotating);
+
+void frame_present();
+
 void help();
 
 void credits();
 
 void load_options();
 
-void start_round(const char *level);
+void select_level_id(int i);
 
-void spawn_particle(base_t const * base, int x, int y, float rot);
+void start_round(const char *level);
 
 void fire_projectile(base_t const * base, float2 pos, float2 vel);
 
+void fx_fire_projectile(base_t const * base, fixed2 pos, fixed2 vel);
+
+void trail_push(projectile_t *p, float2 pos);
+
+fixed2 fx_field_acceleration(fixed2 pos);
+
 affector_t * create_affector(base_t const * owner, int type, float2 pos);
 
+void affector_remove(affector_t *a);
+
+void affectors_clear();
+
+void affectors_renumber();
+
+affector_handle_t affector_handle(affector_t const *a);
+
+affector_t *affector_get(affector_handle_t handle);
+
+float2 field_acceleration(float2 pos);
+
+#define LEVEL_MAX_BLOCKS 256
+
+int read_level(const char *file, SDL_Rect *blocks, int maxBlocks);
+
+void set_level(SDL_Rect const *blocks, int count);
+
 void load_level(const char *file);
 
+void *arena_alloc(arena_t *arena, size_t size);
+
+void arena_reset(arena_t *arena);
+
+void arena_report(FILE *f);
+
+void rng_seed(rng_t *rng, uint64_t seed, uint64_t stream);
+
+uint32_t rng_next(rng_t *rng);
+
+uint32_t rng_range(rng_t *rng, uint32_t n);
+
+uint32_t rng_new_seed();
+
+void affectors_init();
+
+affector_pack_t const *affector_pack();
+
+void battle_reset();
+
+int battle_tick(float dt);
+
+void match_init();
+
+void turn_begin(base_t *player);
+
+void launch_projectile(base_t *player, float angle);
+
+uint32_t state_hash();
+
+void capture_turn(base_t *player, float angle, turn_t *turn);
+
+float apply_turn(base_t *player, turn_t const *turn);
+
+bool turn_legal(base_t const *player, turn_t const *turn);
+
+bool net_listen(int port);
+
+bool net_connect(const char *host, int port);
+
+bool net_write(void const *data, int len);
+
+bool net_read(void *data, int len);
+
+bool net_readable();
+
+bool net_start();
+
+void replay_begin(const char *file, int level);
+
+void replay_start(int level);
+
+void replay_turn(turn_t const *turn);
+
+void replay_tick();
+
+void replay_battle();
+
+int levels_preload();
+
+bool replay_verify(uint8_t const *data, int len, game_options_t const *rules, replay_result_t *result, const char **error);
+
+int verify_daemon(const char *path, int workers);
+
+int verify_client(const char *path, int count, char **files);
+
+bool spectate_listen(const char *path);
+
+void spectate_keyframe(bool reset);
+
+void spectate_tick();
+
+void spectate_flush();
+
+void spectate_drop(int viewer);
+
+int spectate_client(const char *path);
+
+int analyze_levels(const char *dir, float step, int setupCount, char **setupFiles, int workers);
+
+int generate_levels(const char *dir, int keep, int count, uint32_t seed, int symmetry, int setupCount, char **setupFiles, int workers);
+
+SDL_Surface *headless_init();
+
+int render_test(const char *dir, bool update);
+
+int replay_test();
+
+int export_video(const char *replay, const char *file);
+
+bool stats_open(const char *name);
+
+int stats_read(const char *name, int interval);
+
+bool net_send_turn(turn_t const *turn);
+
+bool net_receive_turn(base_t *player, turn_t *turn);
+
+/**
+ * Lockstep network play.
+ * netLocalPlayer is the base controlled on this machine.
+ **/
+#define NET_NONE    0
+#define NET_HOST    1
+#define NET_CONNECT 2
+
+int netMode = NET_NONE;
+const char *netHost = "127.0.0.1";
+int netPort = 7373;
+int netLevel = 1;
+bool netBot = false;
+bool netDesync = false;
+base_t *netLocalPlayer = NULL;
+
+const char *replayFile = NULL;
+int currentLevel = 1;
+
+const char *verifyPath = NULL;
+int verifyWorkers = 0;
+
+#define ANALYSIS_MAX_SETUPS 8
+
+const char *analyzeDir = NULL;
+float analyzeStep = 0.1;
+char *analyzeSetups[ANALYSIS_MAX_SETUPS];
+int analyzeSetupCount = 0;
+
+#define SYMMETRY_NONE   0
+#define SYMMETRY_MIRROR 1 // left/right, like the bases
+#define SYMMETRY_BOTH   2 // left/right and top/bottom
+
+const char *generateDir = NULL;
+int generateCount = 10;
+int generateCandidates = 2000;
+uint32_t generateSeed = 0;
+int generateSymmetry = SYMMETRY_MIRROR;
+
+const char *renderTestDir = NULL;
+bool renderTestUpdate = false;
+
+bool replayTest = false;
+
+const char *exportReplay = NULL;
+const char *exportFile = NULL;
+
+const char *broadcastPath = NULL;
+const char *spectatePath = NULL;
+
+/**
+ * Live statistics for external monitoring. With --stats NAME the game
+ * keeps a POSIX shared memory segment NAME up to date every frame,
+ * --read-stats NAME prints it.
+ *
+ * The segment is a stats_segment_t. It is written like a seqlock: the
+ * sequence is odd while the game writes, so readers copy the statistics
+ * and retry if the sequence was odd or changed meanwhile. The game never
+ * waits for a reader and publishing needs no system call.
+ **/
+#define STATS_MAGIC   0x54534D49 // "IMST"
+#define STATS_VERSION 1
+
+enum {
+	STATS_PHASE_MENU,
+	STATS_PHASE_BUILD,
+	STATS_PHASE_AIM,
+	STATS_PHASE_SIMULATE,
+	STATS_PHASE_REMOTE, // waiting for the turn of the other player
+	STATS_PHASE_COUNT,
+};
+
+const char *statsPhaseNames[STATS_PHASE_COUNT] = { "menu", "build", "aim", "simulate", "remote" };
+
+typedef struct {
+	uint64_t frames;
+	uint64_t ticks;               // simulation ticks since the start
+	uint32_t phase;
+	float frameMs;                // between the last two presents
+	float tickMs;                 // mean simulation tick of the last battle frame
+	uint32_t projectiles;         // active
+	uint32_t trailPoints;         // positions in the trails of all projectiles
+	uint32_t affectors;
+	uint32_t turn;                // of the current match
+	int32_t lifepoints[2];        // left, right
+	uint32_t matches;             // finished
+	uint32_t wins[2];             // left, right
+	uint32_t desyncs;
+	uint32_t arenaAllocations[3]; // level, match, turn; since the last reset
+	uint32_t arenaResets[3];
+	uint64_t arenaTotalAllocations[3];
+	uint64_t arenaBytes[3];
+	uint64_t arenaReserved[3];
+} stats_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; // of stats
+	uint32_t pid;
+	SDL_atomic_t sequence;
+	uint32_t reserved;
+	stats_t stats;
+} stats_segment_t;
+
+const char *statsName = NULL;
+stats_segment_t *statsSegment = NULL;
+stats_t gameStats; // the parts the game loops update themselves
+
+const char *readStatsName = NULL;
+int readStatsInterval = 0;
+
 int main(int argc, char **argv)
 {
+	log_init();
+	
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--host") == 0 && (i + 1) < argc) {
+			netMode = NET_HOST;
+			netPort = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--connect") == 0 && (i + 2) < argc) {
+			netMode = NET_CONNECT;
+			netHost = argv[++i];
+			netPort = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--level") == 0 && (i + 1) < argc) {
+			netLevel = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--bot") == 0) {
+			netBot = true;
+			battleSpeed = 8;
+		}
+		else if(strcmp(argv[i], "--memstats") == 0) {
+			printMemoryStats = true;
+		}
+		else if(strcmp(argv[i], "--broadcast") == 0 && (i + 1) < argc) {
+			broadcastPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--spectate") == 0 && (i + 1) < argc) {
+			spectatePath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--stats") == 0 && (i + 1) < argc) {
+			statsName = argv[++i];
+		}
+		else if(strcmp(argv[i], "--read-stats") == 0 && (i + 1) < argc) {
+			readStatsName = argv[++i];
+		}
+		else if(strcmp(argv[i], "--interval") == 0 && (i + 1) < argc) {
+			readStatsInterval = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--record") == 0 && (i + 1) < argc) {
+			replayFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "--verify-daemon") == 0 && (i + 1) < argc) {
+			verifyPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--workers") == 0 && (i + 1) < argc) {
+			verifyWorkers = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--analyze-levels") == 0 && (i + 1) < argc) {
+			analyzeDir = argv[++i];
+		}
+		else if(strcmp(argv[i], "--generate-levels") == 0 && (i + 1) < argc) {
+			generateDir = argv[++i];
+		}
+		else if(strcmp(argv[i], "--count") == 0 && (i + 1) < argc) {
+			generateCount = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--candidates") == 0 && (i + 1) < argc) {
+			generateCandidates = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--seed") == 0 && (i + 1) < argc) {
+			generateSeed = strtoul(argv[++i], NULL, 0);
+		}
+		else if(strcmp(argv[i], "--symmetry") == 0 && (i + 1) < argc) {
+			i++;
+			generateSymmetry =
+				(strcmp(argv[i], "none") == 0) ? SYMMETRY_NONE :
+				(strcmp(argv[i], "both") == 0) ? SYMMETRY_BOTH : SYMMETRY_MIRROR;
+		}
+		else if(strcmp(argv[i], "--render-test") == 0 && (i + 1) < argc) {
+			renderTestDir = argv[++i];
+		}
+		else if(strcmp(argv[i], "--export-video") == 0 && (i + 2) < argc) {
+			exportReplay = argv[++i];
+			exportFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "--replay-test") == 0) {
+			replayTest = true;
+		}
+		else if(strcmp(argv[i], "--update-golden") == 0) {
+			renderTestUpdate = true;
+		}
+		else if(strcmp(argv[i], "--step") == 0 && (i + 1) < argc) {
+			analyzeStep = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--setup") == 0 && (i + 1) < argc && analyzeSetupCount < ANALYSIS_MAX_SETUPS) {
+			analyzeSetups[analyzeSetupCount++] = argv[++i];
+		}
+		else if(strcmp(argv[i], "--verify") == 0 && (i + 2) < argc) {
+			return verify_client(argv[i + 1], argc - i - 2, argv + i + 2);
+		}
+		else {
+			fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+			fprintf(stderr, "Usage: %s [--host PORT [--level N] | --connect HOST PORT] [--bot] [--record FILE] [--broadcast SOCKET] [--stats NAME] [--memstats]\n", argv[0]);
+			fprintf(stderr, "       %s --spectate SOCKET\n", argv[0]);
+			fprintf(stderr, "       %s --read-stats NAME [--interval MS]\n", argv[0]);
+			fprintf(stderr, "       %s --verify-daemon SOCKET [--workers N]\n", argv[0]);
+			fprintf(stderr, "       %s --verify SOCKET REPLAY...\n", argv[0]);
+			fprintf(stderr, "       %s --analyze-levels DIR [--step DEGREES] [--setup FILE]... [--workers N]\n", argv[0]);
+			fprintf(stderr, "       %s --render-test DIR [--update-golden]\n", argv[0]);
+			fprintf(stderr, "       %s --replay-test\n", argv[0]);
+			fprintf(stderr, "       %s --export-video REPLAY FILE\n", argv[0]);
+			fprintf(stderr, "       %s --generate-levels DIR [--count N] [--candidates N] [--seed N] [--symmetry none|mirror|both] [--setup FILE]... [--workers N]\n", argv[0]);
+			exit(1);
+		}
+	}
+	
+	if(readStatsName != NULL) {
+		return stats_read(readStatsName, readStatsInterval);
+	}
+	
+	fx_init();
+	
+	load_options();
+	log_start();
+	
+	if(verifyPath != NULL) {
+		return verify_daemon(verifyPath, verifyWorkers);
+	}
+	if(analyzeDir != NULL) {
+		return analyze_levels(analyzeDir, analyzeStep, analyzeSetupCount, analyzeSetups, verifyWorkers);
+	}
+	if(generateDir != NULL) {
+		if(generateSeed == 0) {
+			generateSeed = rng_new_seed();
+		}
+		return generate_levels(generateDir, generateCount, generateCandidates, generateSeed,
+			generateSymmetry, analyzeSetupCount, analyzeSetups, verifyWorkers);
+	}
+	
+	if(renderTestDir != NULL) {
+		return render_test(renderTestDir, renderTestUpdate);
+	}
+	if(replayTest) {
+		return replay_test();
+	}
+	if(exportReplay != NULL) {
+		return export_video(exportReplay, exportFile);
+	}
+	
 	if(SDL_Init(SDL_INIT_EVERYTHING) < 0) {
 		fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
 		exit(1);
@@ -240,8 +964,7 @@ int main(int argc, char **argv)
 		printf("Mix_OpenAudio: %s\n", Mix_GetError());
 		exit(1);
 	}
-	
-	load_options();
+	audio_init();
 	
 	window = SDL_CreateWindow(
 		"iAIM",
@@ -264,7 +987,27 @@ int main(int argc, char **argv)
 	
 	load_resources();
 	
-	Mix_PlayChannel(-1, sndStartup, 0);
+	audio_emit(SND_STARTUP);
+	audio_flush();
+	
+	if(spectatePath != NULL) {
+		return spectate_client(spectatePath);
+	}
+	if(broadcastPath != NULL && spectate_listen(broadcastPath) == false) {
+		exit(1);
+	}
+	if(statsName != NULL && stats_open(statsName) == false) {
+		exit(1);
+	}
+	
+	if(netMode != NET_NONE) {
+		if(net_start() == false) {
+			exit(1);
+		}
+		select_level_id(netLevel);
+		Mix_CloseAudio();
+		return netDesync ? 2 : 0;
+	}
 	
 	menu();
 	
@@ -276,16 +1019,103 @@ int main(int argc, char **argv)
 void select_level_id(int i)
 {
 	char name[256];
+	currentLevel = i;
 	sprintf(name, "levels/%02d.txt", i);
-	fprintf(stdout, "Start round: %s\n", name);
+	LOG_INFO("Start round: %s", name);
 	start_round(name);
+	if(printMemoryStats) {
+		arena_report(stderr);
+	}
 }
 
-void select_level()
-{
+/**
+ * Draws the level selection, selection 4 is the back button.
+ **/
+void render_level_selection(int selection)
+{
+	SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+	SDL_RenderClear(renderer);
+	
+	SDL_Rect fullscreen = {
+		0, 0,
+		1280, 720,
+	};
+	
+	SDL_RenderCopy(
+		renderer,
+		texLevelBackground,
+		NULL,
+		&fullscreen);
+	for(int i = 0; i < 4; i++)
+	{
+		SDL_Rect selector = {
+			218 + 424 * (i % 2),
+			63 + 299 * (i / 2),
+			420,
+			295
+		};
+		if(selection == i) {
+			SDL_SetTextureAlphaMod(texLevels[i], 255);
+		} else {
+			SDL_SetTextureAlphaMod(texLevels[i], 76);
+		}
+		if(selection == i) {
+			selector.x -= 2;
+			selector.y -= 2;
+			selector.w += 4;
+			selector.h += 4;
+			SDL_RenderCopy(
+				renderer,
+				texLevelSelector,
+				NULL,
+				&selector);
+			selector.x += 2;
+			selector.y += 2;
+			selector.w -= 4;
+			selector.h -= 4;
+		} 
+		SDL_RenderCopy(
+			renderer,
+			texLevels[i],
+			NULL,
+			&selector);
+	}
+	
+	{ // Launch Button
+		int x,y;
+		int buttons = SDL_GetMouseState(&x, &y);
+		
+		SDL_Rect button = {
+			1109, 615,
+			124, 44
+		};
+		SDL_Texture *tex = texButtonBack[BUTTON_NORMAL];
+		
+		if((x >= button.x && x < (button.x + button.w) &&
+		   y >= button.y && y < (button.y + button.h)) ||
+			 selection == 4)
+		{
+			if(buttons & SDL_BUTTON(SDL_BUTTON_LEFT)) {
+				tex = texButtonBack[BUTTON_PRESSED];
+			} else {
+				tex = texButtonBack[BUTTON_HOVER];
+			}
+		}
+		
+		SDL_RenderCopy(
+			renderer,
+			tex,
+			NULL,
+			&button);
+	}
+}
+
+void select_level()
+{
 	int currentSelection = 0;
 	while(true)
 	{
+		gameStats.phase = STATS_PHASE_MENU;
 		SDL_Event e;
 		while(SDL_PollEvent(&e))
 		{
@@ -375,83 +1205,9 @@ void select_level()
 			}
 		}
 		
-		SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
-		SDL_RenderClear(renderer);
-		
-		SDL_Rect fullscreen = {
-			0, 0,
-			1280, 720,
-		};
-		
-		SDL_RenderCopy(
-			renderer,
-			texLevelBackground,
-			NULL,
-			&fullscreen);
-		for(int i = 0; i < 4; i++)
-		{
-			SDL_Rect selector = {
-				218 + 424 * (i % 2),
-				63 + 299 * (i / 2),
-				420,
-				295
-			};
-			if(currentSelection == i) {
-				SDL_SetTextureAlphaMod(texLevels[i], 255);
-			} else {
-				SDL_SetTextureAlphaMod(texLevels[i], 76);
-			}
-			if(currentSelection == i) {
-				selector.x -= 2;
-				selector.y -= 2;
-				selector.w += 4;
-				selector.h += 4;
-				SDL_RenderCopy(
-					renderer,
-					texLevelSelector,
-					NULL,
-					&selector);
-				selector.x += 2;
-				selector.y += 2;
-				selector.w -= 4;
-				selector.h -= 4;
-			} 
-			SDL_RenderCopy(
-				renderer,
-				texLevels[i],
-				NULL,
-				&selector);
-		}
-		
-		{ // Launch Button
-			int x,y;
-			int buttons = SDL_GetMouseState(&x, &y);
-			
-			SDL_Rect button = {
-				1109, 615,
-				124, 44
-			};
-			SDL_Texture *tex = texButtonBack[BUTTON_NORMAL];
-			
-			if((x >= button.x && x < (button.x + button.w) &&
-			   y >= button.y && y < (button.y + button.h)) ||
-				 currentSelection == 4)
-			{
-				if(buttons & SDL_BUTTON(SDL_BUTTON_LEFT)) {
-					tex = texButtonBack[BUTTON_PRESSED];
-				} else {
-					tex = texButtonBack[BUTTON_HOVER];
-				}
-			}
-			
-			SDL_RenderCopy(
-				renderer,
-				tex,
-				NULL,
-				&button);
-		}
+		render_level_selection(currentSelection);
 		
-		SDL_RenderPresent(renderer);
+		frame_present();
 	
 		SDL_Delay(16);
 	}
@@ -471,11 +1227,52 @@ void menu_select(int i)
 	}
 }
 
+/**
+ * Draws the main menu with the item selection highlighted.
+ **/
+void render_menu(int selection)
+{
+	SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+	SDL_RenderClear(renderer);
+	
+	SDL_Rect fullscreen = {
+		0, 0,
+		1280, 720,
+	};
+	
+	SDL_Rect menuitems = {
+		549, 435,
+		180, 206,
+	};
+	
+	SDL_Rect selector = {
+		527, 433 + 55 * selection,
+		226, 40,
+	};
+	
+	SDL_RenderCopy(
+		renderer,
+		texMenuBackground,
+		NULL,
+		&fullscreen);
+	SDL_RenderCopy(
+		renderer,
+		texMenuSelector,
+		NULL,
+		&selector);
+	SDL_RenderCopy(
+		renderer,
+		texMenuItems,
+		NULL,
+		&menuitems);
+}
+
 void menu()
 {	
 	int currentSelection = 0;
 	while(true)
 	{
+		gameStats.phase = STATS_PHASE_MENU;
 		SDL_Event e;
 		while(SDL_PollEvent(&e))
 		{
@@ -531,41 +1328,9 @@ void menu()
 			}
 		}
 		
-		SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
-		SDL_RenderClear(renderer);
-		
-		SDL_Rect fullscreen = {
-			0, 0,
-			1280, 720,
-		};
-		
-		SDL_Rect menuitems = {
-			549, 435,
-			180, 206,
-		};
-		
-		SDL_Rect selector = {
-			527, 433 + 55 * currentSelection,
-			226, 40,
-		};
-		
-		SDL_RenderCopy(
-			renderer,
-			texMenuBackground,
-			NULL,
-			&fullscreen);
-		SDL_RenderCopy(
-			renderer,
-			texMenuSelector,
-			NULL,
-			&selector);
-		SDL_RenderCopy(
-			renderer,
-			texMenuItems,
-			NULL,
-			&menuitems);
+		render_menu(currentSelection);
 		
-		SDL_RenderPresent(renderer);
+		frame_present();
 	
 		SDL_Delay(16);
 	}
@@ -597,7 +1362,7 @@ void credits()
 			NULL,
 			&fullscreen);
 		
-		SDL_RenderPresent(renderer);
+		frame_present();
 	
 		SDL_Delay(16);
 	}
@@ -630,190 +1395,721 @@ void help()
 			NULL,
 			&fullscreen);
 		
-		SDL_RenderPresent(renderer);
+		frame_present();
 	
 		SDL_Delay(16);
 	}
 }	
 
-void setTextureColor(base_t const * b, SDL_Texture *tex)
+/**
+ * Audio events.
+ * The game code never plays sounds directly, it emits events into a
+ * lock-free single producer / single consumer ring that the main thread
+ * drains once per frame with audio_flush(). Events of the same sound
+ * within AUDIO_COALESCE_MS are merged by raising the volume of the voice
+ * that already plays instead of starting a new one, and every sound may
+ * only use AUDIO_VOICES_PER_SOUND of the AUDIO_MAX_VOICES mixer channels.
+ **/
+#define AUDIO_QUEUE_SIZE       256 // must be a power of two
+#define AUDIO_COALESCE_MS      60
+#define AUDIO_MAX_VOICES       16
+#define AUDIO_VOICES_PER_SOUND 3
+#define AUDIO_BASE_VOLUME      64
+#define AUDIO_COALESCE_GAIN    16
+
+struct {
+	uint8_t events[AUDIO_QUEUE_SIZE];
+	SDL_atomic_t head;
+	SDL_atomic_t tail;
+	SDL_atomic_t dropped;
+} audioQueue;
+
+struct {
+	int channels[AUDIO_VOICES_PER_SOUND];
+	int newest;
+	int volume;
+	uint32_t lastStart;
+} audioVoices[SND_COUNT];
+
+void audio_init()
 {
-	SDL_SetTextureColorMod(tex, b->color.r, b->color.g, b->color.b);
+	Mix_AllocateChannels(AUDIO_MAX_VOICES);
+	for(int i = 0; i < SND_COUNT; i++) {
+		for(int j = 0; j < AUDIO_VOICES_PER_SOUND; j++) {
+			audioVoices[i].channels[j] = -1;
+		}
+	}
+	audioEnabled = true;
 }
 
-
-void render_battleground()
+void audio_emit(int snd)
 {
-	SDL_RenderSetClipRect(renderer, &battleground);
+	if(audioEnabled == false) {
+		return;
+	}
+	int head = SDL_AtomicGet(&audioQueue.head);
+	int tail = SDL_AtomicGet(&audioQueue.tail);
+	if((head - tail) >= AUDIO_QUEUE_SIZE) {
+		// queue is full, a flood of sounds wouldn't be audible anyway
+		SDL_AtomicAdd(&audioQueue.dropped, 1);
+		return;
+	}
+	audioQueue.events[head & (AUDIO_QUEUE_SIZE - 1)] = snd;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&audioQueue.head, head + 1);
+}
 
-	SDL_RenderCopy(
-		renderer,
-		texPlayArea,
-		NULL,
-		&battleground);
-	
-	
-	{ // Draw base background
-		SDL_Rect leftBaseRect = {
-			battleground.x,
-			(battleground.h - 256) / 2,
-			128,
-			256,
-		};
-		
-		SDL_Rect rightBaseRect = {
-			battleground.x + battleground.w - 128,
-			(battleground.h - 256) / 2,
-			128,
-			256,
-		};
-		
-		SDL_Rect sourceRect = {
-			0, 0,
-			128, 256
-		};
-		
-		// setTextureColor(&leftBase, texBase);
-		sourceRect.x = 128;
-		SDL_RenderCopy(
-			renderer,
-			texBaseShips,
-			&sourceRect,
-			&leftBaseRect);
-			
-		// setTextureColor(&rightBase, texBase);
-		sourceRect.x = 0;
-		SDL_RenderCopy(
-			renderer,
-			texBaseShips,
-			&sourceRect,
-			&rightBaseRect);
-		
-		leftBaseRect.x -= 128;
-		leftBaseRect.w += 128;
-		
-		rightBaseRect.w += 128;
-			
-		SDL_SetTextureAlphaMod(texBase, 255 * leftBase.lifepoints / BASE_LIFEPOINTS);
-		SDL_RenderCopyEx(
-			renderer,
-			texBase,
-			NULL,
-			&leftBaseRect,
-			framecounter / 8.0,
-			NULL,
-			SDL_FLIP_NONE);
-		
-		SDL_SetTextureAlphaMod(texBase, 255 * rightBase.lifepoints / BASE_LIFEPOINTS);
-		SDL_RenderCopyEx(
-			renderer,
-			texBase,
-			NULL,
-			&rightBaseRect,
-			-framecounter / 6.0,
-			NULL,
-			SDL_FLIP_NONE);
-			
-		framecounter += 1;
+static void audio_play(int snd, uint32_t now)
+{
+	int playing = 0;
+	int freeSlot = -1;
+	for(int i = 0; i < AUDIO_VOICES_PER_SOUND; i++) {
+		int ch = audioVoices[snd].channels[i];
+		if(ch >= 0 && Mix_Playing(ch)) {
+			playing++;
+		} else if(freeSlot < 0) {
+			freeSlot = i;
+		}
 	}
 	
-	for(block_t *b = blockchain; b != NULL; b = b->next)
+	int newest = audioVoices[snd].channels[audioVoices[snd].newest];
+	bool newestPlaying = (newest >= 0 && Mix_Playing(newest));
+	
+	if(newestPlaying && 
+	   ((now - audioVoices[snd].lastStart) < AUDIO_COALESCE_MS || playing >= AUDIO_VOICES_PER_SOUND))
 	{
-		SDL_Rect rect = b->rect;
-		rect.x += battleground.x;
-		
-		// SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
-		// SDL_RenderFillRect(renderer, &rect);
-		SDL_RenderCopy(renderer, texMetal, &rect, &rect);
-			
-		SDL_SetRenderDrawColor(renderer, 96, 96, 96, 255);
-		SDL_RenderDrawRect(renderer, &rect);
+		// coalesce: make the newest voice louder instead of adding a voice
+		audioVoices[snd].volume = MIN(MIX_MAX_VOLUME, audioVoices[snd].volume + AUDIO_COALESCE_GAIN);
+		Mix_Volume(newest, audioVoices[snd].volume);
+		return;
+	}
+	if(freeSlot < 0 || Mix_Playing(-1) >= AUDIO_MAX_VOICES) {
+		return;
 	}
 	
-	// draw base protectors.
-	for(int i = 0; i < 24; i++) {
-	
-		int baseRadius = 136;
-	
-		// left base
-		if(leftBase.protectors[i] > 0) {
-			SDL_Rect target = {
-				battleground.x + baseRadius * sinf(DEG_TO_RAD(15 * i - PROTECTOR_OFFSET)) - 6,
-				battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(15 * i - PROTECTOR_OFFSET)) - 15,
-				12,
-				30,
-			};
-			SDL_Texture *tex = texBarricade[3 - leftBase.protectors[i]];
-			setTextureColor(&leftBase, tex);
-			SDL_RenderCopyEx(
-				renderer,
-				texBarricade[3 - leftBase.protectors[i]],
-				NULL,
-				&target,
-				-15 * i - 90 + PROTECTOR_OFFSET,
-				NULL,
-				SDL_FLIP_NONE);
-		}
-		
-		if(rightBase.protectors[i] > 0) {
-			SDL_Rect target = {
-				battleground.x + battleground.w - baseRadius * sinf(DEG_TO_RAD(15 * i + PROTECTOR_OFFSET)) - 6,
-				battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(15 * i + PROTECTOR_OFFSET)) - 15,
-				12,
-				30,
-			};
-			SDL_Texture *tex = texBarricade[3 - rightBase.protectors[i]];
-			setTextureColor(&rightBase, tex);
-			SDL_RenderCopyEx(
-				renderer,
-				tex,
-				NULL,
-				&target,
-				15 * i - 90 + PROTECTOR_OFFSET,
-				NULL,
-				SDL_FLIP_NONE);
-		}
+	int ch = Mix_PlayChannel(-1, sounds[snd], 0);
+	if(ch < 0) {
+		return;
 	}
+	Mix_Volume(ch, AUDIO_BASE_VOLUME);
+	audioVoices[snd].channels[freeSlot] = ch;
+	audioVoices[snd].newest = freeSlot;
+	audioVoices[snd].volume = AUDIO_BASE_VOLUME;
+	audioVoices[snd].lastStart = now;
 	
-	{ // Draw particles
-		for(particle_t * p = particles; p != NULL; p = p->next)
-		{
-			if(p->progress >= 200) {
-				continue;
+	// a mixer channel belongs to one sound only
+	for(int i = 0; i < SND_COUNT; i++) {
+		for(int j = 0; i != snd && j < AUDIO_VOICES_PER_SOUND; j++) {
+			if(audioVoices[i].channels[j] == ch) {
+				audioVoices[i].channels[j] = -1;
 			}
-			setTextureColor(p->base, texParticle);
-			
-			SDL_Rect target = {
-				battleground.x + p->x, p->y - 5,
-				1, 11
-			};
-			SDL_Rect source = {
-				p->progress, 0,
-				1, 11
-			};
-			
-			SDL_RenderCopyEx(
-				renderer,
-				texParticle,
-				&source,
-				&target,
-				p->rotation,
-				NULL,
-				SDL_FLIP_NONE);
-		
 		}
 	}
-	
-	{ // Draw projectiles
-		for(projectile_t * p = projectiles; p != NULL; p = p->next)
-		{
-			if(p->active == false) {
-				continue;
-			}
-			setTextureColor(p->base, texProjectile);
+}
+
+void audio_flush()
+{
+	if(audioEnabled == false) {
+		return;
+	}
+	uint32_t now = SDL_GetTicks();
+	int head = SDL_AtomicGet(&audioQueue.head);
+	int tail = SDL_AtomicGet(&audioQueue.tail);
+	SDL_MemoryBarrierAcquire();
+	for(; tail != head; tail++) {
+		audio_play(audioQueue.events[tail & (AUDIO_QUEUE_SIZE - 1)], now);
+	}
+	SDL_AtomicSet(&audioQueue.tail, tail);
+}
+
+/**
+ * Logging.
+ * log_write() formats a record into a lock-free multi producer / single
+ * consumer ring and returns, the log thread writes the records to
+ * logFile (or stderr) every LOG_FLUSH_MS. A slow terminal, pipe or disk
+ * only ever blocks the log thread: when the ring is full, new records are
+ * dropped and counted instead of waiting for space.
+ * Every slot carries a sequence number: it equals the write position when
+ * the slot is free and the write position + 1 when the record is ready.
+ **/
+#define LOG_QUEUE_SIZE   1024 // must be a power of two
+#define LOG_MESSAGE_SIZE 160
+#define LOG_FLUSH_MS     20
+
+typedef struct {
+	SDL_atomic_t sequence;
+	uint32_t time;
+	int level;
+	const char *func;
+	char message[LOG_MESSAGE_SIZE];
+} log_record_t;
+
+struct {
+	log_record_t records[LOG_QUEUE_SIZE];
+	SDL_atomic_t head;
+	int tail; // only used by the log thread
+	SDL_atomic_t dropped;
+	SDL_atomic_t running;
+	SDL_Thread *thread;
+	FILE *output;
+} logQueue;
+
+static const char *logLevelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+void log_init()
+{
+	for(int i = 0; i < LOG_QUEUE_SIZE; i++) {
+		SDL_AtomicSet(&logQueue.records[i].sequence, i);
+	}
+	logQueue.output = stderr;
+}
+
+void log_write(int level, const char *func, const char *format, ...)
+{
+	if(level < logLevel) {
+		return;
+	}
+	log_record_t *r;
+	int head = SDL_AtomicGet(&logQueue.head);
+	while(true) {
+		r = &logQueue.records[head & (LOG_QUEUE_SIZE - 1)];
+		int diff = SDL_AtomicGet(&r->sequence) - head;
+		if(diff == 0) {
+			if(SDL_AtomicCAS(&logQueue.head, head, head + 1)) {
+				break;
+			}
+		} else if(diff < 0) {
+			// the log thread is behind a whole ring
+			SDL_AtomicAdd(&logQueue.dropped, 1);
+			return;
+		}
+		head = SDL_AtomicGet(&logQueue.head);
+	}
+	
+	r->time = SDL_GetTicks();
+	r->level = level;
+	r->func = func;
+	va_list args;
+	va_start(args, format);
+	vsnprintf(r->message, LOG_MESSAGE_SIZE, format, args);
+	va_end(args);
+	
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&r->sequence, head + 1);
+}
+
+/**
+ * Writes all ready records, returns their number.
+ **/
+static int log_drain()
+{
+	int count = 0;
+	while(true) {
+		log_record_t *r = &logQueue.records[logQueue.tail & (LOG_QUEUE_SIZE - 1)];
+		if(SDL_AtomicGet(&r->sequence) != logQueue.tail + 1) {
+			break;
+		}
+		SDL_MemoryBarrierAcquire();
+		fprintf(logQueue.output, "%6u.%03u %-5s %s: %s\n",
+			r->time / 1000, r->time % 1000,
+			logLevelNames[r->level],
+			r->func,
+			r->message);
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&r->sequence, logQueue.tail + LOG_QUEUE_SIZE);
+		logQueue.tail++;
+		count++;
+	}
+	
+	int dropped = SDL_AtomicSet(&logQueue.dropped, 0);
+	if(dropped > 0) {
+		fprintf(logQueue.output, "%d log records dropped\n", dropped);
+	}
+	if(count > 0 || dropped > 0) {
+		fflush(logQueue.output);
+	}
+	return count;
+}
+
+static int log_thread(void *data)
+{
+	while(SDL_AtomicGet(&logQueue.running)) {
+		if(log_drain() == 0) {
+			SDL_Delay(LOG_FLUSH_MS);
+		}
+	}
+	log_drain();
+	return 0;
+}
+
+static void log_stop()
+{
+	SDL_AtomicSet(&logQueue.running, 0);
+	SDL_WaitThread(logQueue.thread, NULL);
+	if(logQueue.output != stderr) {
+		fclose(logQueue.output);
+	}
+}
+
+/**
+ * Opens logFile and starts the log thread, records written before are
+ * kept in the ring until then.
+ **/
+void log_start()
+{
+	if(logFile[0] != 0) {
+		FILE *f = fopen(logFile, "a");
+		if(f != NULL) {
+			logQueue.output = f;
+		} else {
+			LOG_WARN("Failed to open log file %s, logging to stderr.", logFile);
+		}
+	}
+	SDL_AtomicSet(&logQueue.running, 1);
+	logQueue.thread = SDL_CreateThread(log_thread, "log", NULL);
+	if(logQueue.thread == NULL) {
+		fprintf(stderr, "Failed to start the log thread: %s\n", SDL_GetError());
+		return;
+	}
+	atexit(log_stop);
+}
+
+/**
+ * Returns the seconds passed since the last call and updates *last.
+ * Long hitches are clamped so the game slows down instead of jumping.
+ **/
+float frame_time(uint64_t *last)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+	float t = (float)(now - *last) / SDL_GetPerformanceFrequency();
+	*last = now;
+	return MIN(t, MAX_FRAME_TIME);
+}
+
+void setTextureColor(base_t const * b, SDL_Texture *tex)
+{
+	SDL_SetTextureColorMod(tex, b->color.r, b->color.g, b->color.b);
+}
+
+
+/**
+ * Draws the trail of a projectile as one textured triangle strip.
+ * The particle texture fades out from left to right, each tick of age
+ * moves 2 texels further (like the particles the trails once were).
+ **/
+void render_trail(projectile_t const *p)
+{
+	float2 points[TRAIL_LENGTH];
+	int ages[TRAIL_LENGTH];
+	SDL_Vertex vertices[2 * TRAIL_LENGTH];
+	int indices[6 * (TRAIL_LENGTH - 1)];
+	
+	// newest to oldest position that is still visible
+	int count = 0;
+	for(int i = 0; i < p->trailCount; i++) {
+		int age = battleTicks - 1 - p->trailTick + i;
+		if(age >= TRAIL_LENGTH) {
+			break;
+		}
+		points[count] = p->trail[(p->trailHead - i + TRAIL_LENGTH) % TRAIL_LENGTH];
+		ages[count] = MAX(age, 0);
+		count++;
+	}
+	if(count < 2) {
+		return;
+	}
+	
+	int texWidth;
+	SDL_QueryTexture(texParticle, NULL, NULL, &texWidth, NULL);
+	
+	for(int i = 0; i < count; i++) {
+		float2 a = points[(i > 0) ? (i - 1) : i];
+		float2 b = points[(i < count - 1) ? (i + 1) : i];
+		float2 dir = { a.x - b.x, a.y - b.y };
+		float len = length(dir);
+		if(len > 0) {
+			dir.x /= len;
+			dir.y /= len;
+		}
+		float2 normal = {
+			-dir.y * TRAIL_WIDTH / 2,
+			dir.x * TRAIL_WIDTH / 2,
+		};
+		float u = (2 * ages[i] + 0.5) / texWidth;
+		
+		vertices[2*i + 0] = (SDL_Vertex) {
+			{ battleground.x + points[i].x + normal.x, points[i].y + normal.y },
+			p->base->color,
+			{ u, 0 }
+		};
+		vertices[2*i + 1] = (SDL_Vertex) {
+			{ battleground.x + points[i].x - normal.x, points[i].y - normal.y },
+			p->base->color,
+			{ u, 1 }
+		};
+	}
+	for(int i = 0; i < count - 1; i++) {
+		int *quad = &indices[6 * i];
+		quad[0] = 2*i + 0;
+		quad[1] = 2*i + 1;
+		quad[2] = 2*i + 2;
+		quad[3] = 2*i + 1;
+		quad[4] = 2*i + 3;
+		quad[5] = 2*i + 2;
+	}
+	
+	// tinted by the vertex colors
+	SDL_SetTextureColorMod(texParticle, 255, 255, 255);
+	SDL_RenderGeometry(renderer, texParticle, vertices, 2 * count, indices, 6 * (count - 1));
+}
+
+/**
+ * Adds the time since the last call to pass. The render test disables
+ * render batching, so the time is spent where the drawing is requested.
+ **/
+void render_pass_end(int pass)
+{
+	if(renderProfiling) {
+		uint64_t now = SDL_GetPerformanceCounter();
+		renderPassTime[pass] += now - renderPassStart;
+		renderPassStart = now;
+	}
+}
+
+/**
+ * Protector rectangles (relative to the battleground, rotated around their
+ * center) and rotations for one protector offset. The simulation keeps the
+ * layout of the current tick in protectorLayout, so the sines are computed
+ * once per tick instead of for every substep, and only once if the
+ * protectors don't rotate. The renderer shares it while it doesn't
+ * interpolate between ticks.
+ **/
+typedef struct {
+	bool valid;
+	double offset;
+	SDL_Rect rects[2][24];
+	float angles[2][24];
+} protector_layout_t;
+
+THREAD_LOCAL protector_layout_t protectorLayout;
+
+protector_layout_t const *protector_layout(double offset, protector_layout_t *layout)
+{
+	if(layout->valid && layout->offset == offset) {
+		return layout;
+	}
+	int baseRadius = 136;
+	for(int i = 0; i < 24; i++) {
+		layout->rects[0][i] = (SDL_Rect) {
+			baseRadius * sinf(DEG_TO_RAD(15 * i - offset)) - 6,
+			battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(15 * i - offset)) - 15,
+			12,
+			30,
+		};
+		layout->angles[0][i] = -15 * i - 90 + offset;
+		
+		layout->rects[1][i] = (SDL_Rect) {
+			battleground.w - baseRadius * sinf(DEG_TO_RAD(15 * i + offset)) - 6,
+			battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(15 * i + offset)) - 15,
+			12,
+			30,
+		};
+		layout->angles[1][i] = 15 * i - 90 + offset;
+	}
+	layout->offset = offset;
+	layout->valid = true;
+	return layout;
+}
+
+/**
+ * Draws the protectors of both bases, x is the left edge of the battleground.
+ * Protectors never overlap, so they are drawn grouped by texture and tint.
+ * Only the protectors set in mask are drawn, all of them if it is NULL.
+ **/
+void render_protectors(protector_layout_t const *layout, int x, bool (*mask)[24])
+{
+	base_t const *bases[2] = { &leftBase, &rightBase };
+	for(int b = 0; b < 2; b++) {
+		for(int life = 1; life <= 3; life++) {
+			SDL_Texture *tex = texBarricade[3 - life];
+			bool tinted = false;
+			for(int i = 0; i < 24; i++) {
+				if(bases[b]->protectors[i] != life || (mask != NULL && mask[b][i] == false)) {
+					continue;
+				}
+				if(tinted == false) {
+					setTextureColor(bases[b], tex);
+					tinted = true;
+				}
+				SDL_Rect target = layout->rects[b][i];
+				target.x += x;
+				SDL_RenderCopyEx(
+					renderer,
+					tex,
+					NULL,
+					&target,
+					layout->angles[b][i],
+					NULL,
+					SDL_FLIP_NONE);
+			}
+		}
+	}
+}
+
+/**
+ * Draws the background and the ships, x is the left edge of the battleground.
+ **/
+void render_ground(int x)
+{
+	SDL_Rect area = { x, battleground.y, battleground.w, battleground.h };
+	SDL_RenderCopy(
+		renderer,
+		texPlayArea,
+		NULL,
+		&area);
+	
+	SDL_Rect sourceRect = {
+		128, 0,
+		128, 256
+	};
+	SDL_Rect target = {
+		x,
+		(battleground.h - 256) / 2,
+		128,
+		256,
+	};
+	SDL_RenderCopy(
+		renderer,
+		texBaseShips,
+		&sourceRect,
+		&target);
+	
+	sourceRect.x = 0;
+	target.x = x + battleground.w - 128;
+	SDL_RenderCopy(
+		renderer,
+		texBaseShips,
+		&sourceRect,
+		&target);
+}
+
+/**
+ * The rect of the shield of a base (0 = left, 1 = right), x is the left
+ * edge of the battleground.
+ **/
+SDL_Rect shield_rect(int side, int x)
+{
+	SDL_Rect rect = {
+		x - 128 + side * battleground.w,
+		(battleground.h - 256) / 2,
+		256,
+		256,
+	};
+	return rect;
+}
+
+/**
+ * True if rect (relative to the battleground) is below one of the shields.
+ **/
+static bool under_shields(SDL_Rect const *rect)
+{
+	SDL_Rect left = shield_rect(0, 0);
+	SDL_Rect right = shield_rect(1, 0);
+	return SDL_HasIntersection(rect, &left) || SDL_HasIntersection(rect, &right);
+}
+
+#define BLOCKS_ALL           0
+#define BLOCKS_AWAY          1 // only the ones not under the shields
+#define BLOCKS_UNDER_SHIELDS 2
+
+void render_blocks(int x, int which)
+{
+	for(block_t *b = blockchain; b != NULL; b = b->next)
+	{
+		if(which != BLOCKS_ALL && under_shields(&b->rect) != (which == BLOCKS_UNDER_SHIELDS)) {
+			continue;
+		}
+		SDL_Rect rect = b->rect;
+		SDL_Rect target = rect;
+		target.x += x;
+		
+		SDL_RenderCopy(renderer, texMetal, &rect, &target);
+			
+		SDL_SetRenderDrawColor(renderer, 96, 96, 96, 255);
+		SDL_RenderDrawRect(renderer, &target);
+	}
+}
+
+/**
+ * The parts of the battleground that don't move are drawn once into
+ * texBattleLayer, which is copied as a whole every frame: the background,
+ * the ships, the blocks and the protectors if they don't rotate. The
+ * shields are drawn between the ships and the blocks, so the blocks under
+ * them, and the protectors under the shields or on such a block, are left
+ * out of the layer and drawn every frame. The layer is drawn again when
+ * the level or a protector changes.
+ * Returns false if the renderer can't draw into textures.
+ **/
+SDL_Texture *texBattleLayer = NULL;
+
+struct {
+	bool valid;
+	int level; // levelVersion
+	bool withProtectors;
+	int protectors[2][24];
+	bool layered[2][24];   // protectors in the layer
+	bool unlayered[2][24]; // protectors drawn every frame
+} battleLayer;
+
+/**
+ * Splits the protectors into the ones the layer holds and the ones that
+ * must be drawn after the shields and the blocks under them.
+ **/
+static void battle_layer_split(protector_layout_t const *layout)
+{
+	for(int b = 0; b < 2; b++) {
+		for(int i = 0; i < 24; i++) {
+			// bounding box of the rotated rect
+			SDL_Rect r = layout->rects[b][i];
+			int radius = (int)ceilf(sqrtf(r.w * r.w + r.h * r.h) / 2);
+			SDL_Rect bounds = { r.x + r.w / 2 - radius, r.y + r.h / 2 - radius, 2 * radius + 1, 2 * radius + 1 };
+			bool under = under_shields(&bounds);
+			for(block_t *block = blockchain; block != NULL && under == false; block = block->next) {
+				under = under_shields(&block->rect) && SDL_HasIntersection(&bounds, &block->rect);
+			}
+			battleLayer.layered[b][i] = (under == false);
+			battleLayer.unlayered[b][i] = under;
+		}
+	}
+}
+
+static int render_reset_watch(void *data, SDL_Event *e)
+{
+	if(e->type == SDL_RENDER_TARGETS_RESET || e->type == SDL_RENDER_DEVICE_RESET) {
+		battleLayer.valid = false;
+	}
+	return 0;
+}
+
+bool render_battle_layer(protector_layout_t const *layout, bool withProtectors)
+{
+	if(texBattleLayer == NULL) {
+		if(SDL_RenderTargetSupported(renderer) == false) {
+			return false;
+		}
+		texBattleLayer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, battleground.w, battleground.h);
+		if(texBattleLayer == NULL) {
+			LOG_WARN("Failed to create the battleground layer: %s", SDL_GetError());
+			return false;
+		}
+		SDL_SetTextureBlendMode(texBattleLayer, SDL_BLENDMODE_NONE);
+		SDL_AddEventWatch(render_reset_watch, NULL);
+	}
+	
+	if(battleLayer.valid && battleLayer.level == levelVersion && battleLayer.withProtectors == withProtectors &&
+	   (withProtectors == false || (
+	     memcmp(battleLayer.protectors[0], leftBase.protectors, sizeof(leftBase.protectors)) == 0 &&
+	     memcmp(battleLayer.protectors[1], rightBase.protectors, sizeof(rightBase.protectors)) == 0))) {
+		return true;
+	}
+	
+	SDL_SetRenderTarget(renderer, texBattleLayer);
+	render_ground(0);
+	render_blocks(0, BLOCKS_AWAY);
+	if(withProtectors) {
+		battle_layer_split(layout);
+		render_protectors(layout, 0, battleLayer.layered);
+	}
+	SDL_SetRenderTarget(renderer, NULL);
+	
+	battleLayer.valid = true;
+	battleLayer.level = levelVersion;
+	battleLayer.withProtectors = withProtectors;
+	memcpy(battleLayer.protectors[0], leftBase.protectors, sizeof(leftBase.protectors));
+	memcpy(battleLayer.protectors[1], rightBase.protectors, sizeof(rightBase.protectors));
+	return true;
+}
+
+void render_battleground()
+{
+	static protector_layout_t renderLayout;
+	
+	render_pass_end(RENDER_PASS_OTHER);
+	
+	// interpolate between the last two simulation ticks
+	float renderTime = battleTime - (1.0 - renderAlpha) * SIM_DT;
+	double protectorOffset = PROTECTOR_ANGLE(renderTime);
+	protector_layout_t const *layout = protector_layout(protectorOffset,
+		(protectorLayout.valid && protectorLayout.offset == protectorOffset) ? &protectorLayout : &renderLayout);
+	bool staticProtectors = (gameOptions.rotatingProtectors == false);
+	
+	bool layered = render_battle_layer(layout, staticProtectors);
+	SDL_RenderSetClipRect(renderer, &battleground);
+	if(layered) {
+		SDL_RenderCopy(renderer, texBattleLayer, NULL, &battleground);
+	} else {
+		render_ground(battleground.x);
+	}
+	render_pass_end(RENDER_PASS_BACKGROUND);
+	
+	{ // Draw shields
+		SDL_Rect leftBaseRect = shield_rect(0, battleground.x);
+		SDL_Rect rightBaseRect = shield_rect(1, battleground.x);
+		
+		SDL_SetTextureAlphaMod(texBase, 255 * leftBase.lifepoints / BASE_LIFEPOINTS);
+		SDL_RenderCopyEx(
+			renderer,
+			texBase,
+			NULL,
+			&leftBaseRect,
+			renderTime * SHIELD_ROTSPEED_LEFT,
+			NULL,
+			SDL_FLIP_NONE);
+		
+		SDL_SetTextureAlphaMod(texBase, 255 * rightBase.lifepoints / BASE_LIFEPOINTS);
+		SDL_RenderCopyEx(
+			renderer,
+			texBase,
+			NULL,
+			&rightBaseRect,
+			renderTime * SHIELD_ROTSPEED_RIGHT,
+			NULL,
+			SDL_FLIP_NONE);
+	}
+	render_pass_end(RENDER_PASS_BASES);
+	
+	render_blocks(battleground.x, layered ? BLOCKS_UNDER_SHIELDS : BLOCKS_ALL);
+	render_pass_end(RENDER_PASS_BLOCKS);
+	
+	if(layered == false || staticProtectors == false) {
+		render_protectors(layout, battleground.x, NULL);
+	} else {
+		render_protectors(layout, battleground.x, battleLayer.unlayered);
+	}
+	render_pass_end(RENDER_PASS_PROTECTORS);
+	
+	{ // Draw trails
+		for(projectile_t * p = projectiles; p != NULL; p = p->next)
+		{
+			render_trail(p);
+		}
+	}
+	render_pass_end(RENDER_PASS_TRAILS);
+	
+	{ // Draw projectiles
+		for(projectile_t * p = projectiles; p != NULL; p = p->next)
+		{
+			if(p->active == false) {
+				continue;
+			}
+			setTextureColor(p->base, texProjectile);
 			
+			float2 pos = {
+				p->prevPos.x + renderAlpha * (p->pos.x - p->prevPos.x),
+				p->prevPos.y + renderAlpha * (p->pos.y - p->prevPos.y),
+			};
 			SDL_Rect target = {
-				battleground.x + p->pos.x - 5, p->pos.y - 5,
+				battleground.x + pos.x - 5, pos.y - 5,
 				11, 11
 			};
 			
@@ -831,10 +2127,13 @@ void render_battleground()
 		}
 	}
 	
+	render_pass_end(RENDER_PASS_PROJECTILES);
+	
 	// Draw affectors
 	{		
-		for(affector_t *p = affectors; p != NULL; p = p->next)
+		for(int i = 0; i < affectorCount; i++)
 		{
+			affector_t *p = &affectors[i];
 			SDL_Rect target = {
 				battleground.x + p->center.x - 32, p->center.y - 32,
 				64, 64
@@ -851,475 +2150,519 @@ void render_battleground()
 		}
 	}
 	
-	battleTime += (1.0 / 30.0);
+	render_pass_end(RENDER_PASS_AFFECTORS);
 	
 	SDL_RenderSetClipRect(renderer, NULL);
 }
 
-bool player_aim(base_t *player)
+/**
+ * Draws both tool panels, the one of player is open and shows its
+ * affectors. player may be NULL, then both are closed.
+ **/
+void render_tool_panels(base_t const *player)
 {
-	uint32_t nextFrameTime = 0;
-	
-	float a = 15.0;
-	float d = 1.0;
-			
-	int baseRadius = 155;
+	render_pass_end(RENDER_PASS_OTHER);
 	
-	while(true)
-	{
-		float dt = 1.0 / 60.0;
+	SDL_Rect leftPanel = {
+		0, 0, 128, 720
+	};
+	if(player == &leftBase) {
 		
-		SDL_Event e;
-		while(SDL_PollEvent(&e))
-		{
-			if(e.type == SDL_QUIT) exit(0);
-			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) return false;
-			
-			if((e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_SPACE) ||
-			   (e.type == SDL_MOUSEBUTTONDOWN)) {
-				
-				float2 pos, vel;
-				if(player == &leftBase) {
-					pos = (float2){
-						baseRadius * sinf(DEG_TO_RAD(a)) - 6,
-						battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(a)) - 6,
-					};
-					vel = (float2) {
-						sinf(DEG_TO_RAD(a)),
-						cosf(DEG_TO_RAD(a)),
-					};
-				} else {
-					pos = (float2) {
-						battleground.w - baseRadius * sinf(DEG_TO_RAD(a)) - 6,
-						battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(a)) - 6,
-					};
-					vel = (float2){
-						-sinf(DEG_TO_RAD(a)),
-						cosf(DEG_TO_RAD(a)),
-					};
-				}
-				vel.x *= 250;
-				vel.y *= 250;
-				
-				Mix_PlayChannel(-1, sndLaunch, 0);
-				fire_projectile(player, pos, vel);
-				return true;
+		SDL_RenderCopy(
+			renderer,
+			texBackPanel,
+			NULL,
+			&leftPanel);
+		SDL_Rect target = {
+			32, 32, 64, 64
+		};
+		for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
+			int count = player->resources[i];
+			if(count <= 0) {
+				continue;
 			}
-		}
-		
-		SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
-		SDL_RenderClear(renderer);
-		
-		render_battleground();
-		
-		{ // render projectle preview
-			setTextureColor(player, texProjectile);
-			
-			if(player == &leftBase)
-			{
-				SDL_Rect target = {
-					battleground.x + baseRadius * sinf(DEG_TO_RAD(a)) - 6,
-					battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(a)) - 6,
-					11,
-					11
-				};
-				
-				SDL_RenderCopyEx(
-					renderer,
-					texProjectile,
-					NULL,
-					&target,
-					-a + 90,
-					NULL,
-					SDL_FLIP_NONE);
-				} else {
-					SDL_Rect target = {
-						battleground.x + battleground.w - baseRadius * sinf(DEG_TO_RAD(a)) - 6,
-						battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(a)) - 6,
-						11,
-						11
-					};
-					
-					SDL_RenderCopyEx(
-						renderer,
-						texProjectile,
-						NULL,
-						&target,
-						a + 90,
-						NULL,
-						SDL_FLIP_NONE);
-				}
-		}
 		
-		
-		{ // Draw closed tool panels
-			SDL_Rect leftPanel = {
-				0, 0, 128, 720
-			};
 			SDL_RenderCopy(
 				renderer,
-				texLeftPanel,
+				texAffector[i],
 				NULL,
-				&leftPanel);
-				
-			SDL_Rect rightPanel = {
-				battleground.x + battleground.w, 0, 128, 720
+				&target);
+			
+			SDL_Rect number = {
+				target.x + 48, target.y + 48,
+				16, 16
+			};
+			SDL_Rect numberSrc = {
+				16 * count, 0,
+				16, 16
 			};
 			SDL_RenderCopy(
 				renderer,
-				texRightPanel,
-				NULL,
-				&rightPanel);
+				texNumbers,
+				&numberSrc,
+				&number);
+		
+			target.y += 96;
 		}
+	
+	} else {
+		SDL_RenderCopy(
+			renderer,
+			texLeftPanel,
+			NULL,
+			&leftPanel);
+	}
 		
+	SDL_Rect rightPanel = {
+		battleground.x + battleground.w, 0, 128, 720
+	};
+	if(player == &rightBase) {
 		
-		SDL_RenderPresent(renderer);
+		SDL_RenderCopy(
+			renderer,
+			texBackPanel,
+			NULL,
+			&rightPanel);
+		SDL_Rect target = {
+			battleground.x + battleground.w + 32, 32, 
+			64, 64
+		};
+		for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
+			int count = player->resources[i];
+			if(count <= 0) {
+				continue;
+			}
 		
-		while(SDL_GetTicks() < nextFrameTime) {
-			; // BURN!
+			SDL_RenderCopyEx(
+				renderer,
+				texAffector[i],
+				NULL,
+				&target,
+				180,
+				NULL,
+				SDL_FLIP_NONE);
+			
+			SDL_Rect number = {
+				target.x + 48, target.y + 48,
+				16, 16
+			};
+			SDL_Rect numberSrc = {
+				16 * count, 0,
+				16, 16
+			};
+			SDL_RenderCopy(
+				renderer,
+				texNumbers,
+				&numberSrc,
+				&number);
+		
+			target.y += 96;
 		}
-		nextFrameTime = SDL_GetTicks() + 15;
+	} else {
+		SDL_RenderCopy(
+			renderer,
+			texRightPanel,
+			NULL,
+			&rightPanel);
+	}
+	render_pass_end(RENDER_PASS_PANELS);
+}
+
+/**
+ * Draws the projectile of player where it would start at angle.
+ **/
+void render_aim_preview(base_t const *player, float angle)
+{
+	int baseRadius = 155;
+	
+	setTextureColor(player, texProjectile);
+	
+	if(player == &leftBase)
+	{
+		SDL_Rect target = {
+			battleground.x + baseRadius * sinf(DEG_TO_RAD(angle)) - 6,
+			battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(angle)) - 6,
+			11,
+			11
+		};
 		
+		SDL_RenderCopyEx(
+			renderer,
+			texProjectile,
+			NULL,
+			&target,
+			-angle + 90,
+			NULL,
+			SDL_FLIP_NONE);
+	} else {
+		SDL_Rect target = {
+			battleground.x + battleground.w - baseRadius * sinf(DEG_TO_RAD(angle)) - 6,
+			battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(angle)) - 6,
+			11,
+			11
+		};
 		
-		float angularSpeed = 90.0;
-		if(gameOptions.useSlowAiming) {
-			angularSpeed = 45.0;
+		SDL_RenderCopyEx(
+			renderer,
+			texProjectile,
+			NULL,
+			&target,
+			angle + 90,
+			NULL,
+			SDL_FLIP_NONE);
+	}
+}
+
+/**
+ * Draws the rotation knob of the affector being edited, if there is one.
+ **/
+void render_selection(affector_t const *a, bool isRotating)
+{
+	if(a == NULL) {
+		return;
+	}
+	
+	SDL_SetRenderDrawColor(
+		renderer,
+		192, 192, 192, 255);
+	
+	float2 pos = {
+		48 * cosf(DEG_TO_RAD(-a->rotation)),
+		-48 * sinf(DEG_TO_RAD(-a->rotation)),
+	};
+	pos.x += a->center.x;
+	pos.y += a->center.y;
+	SDL_RenderDrawLine(
+		renderer,
+		a->center.x + battleground.x, a->center.y,
+		battleground.x + pos.x, pos.y);
+	
+	SDL_Rect grabbag = {
+		battleground.x + pos.x - 6, pos.y - 6,
+		12, 12
+	};
+	if(isRotating) {
+		SDL_SetRenderDrawColor(
+			renderer,
+			255, 128, 128, 255);
+	}
+	SDL_RenderFillRect(renderer, &grabbag);
+}
+
+/**
+ * Copies gameStats and the current counts into the shared memory segment.
+ **/
+void stats_publish()
+{
+	if(statsSegment == NULL) {
+		return;
+	}
+	
+	stats_t s = gameStats;
+	s.projectiles = 0;
+	s.trailPoints = 0;
+	for(projectile_t const *p = projectiles; p != NULL; p = p->next) {
+		if(p->active) {
+			s.projectiles += 1;
 		}
-		a += angularSpeed * d * dt;
-		
-		// bounces
-		if(a > 165.0) {
-			a = 165.0;
-			d = -1;
+		s.trailPoints += p->trailCount;
+	}
+	s.affectors = affectorCount;
+	s.lifepoints[0] = leftBase.lifepoints;
+	s.lifepoints[1] = rightBase.lifepoints;
+	arena_t const *arenas[] = { &levelArena, &matchArena, &turnArena };
+	for(int i = 0; i < 3; i++) {
+		s.arenaAllocations[i] = arenas[i]->allocations;
+		s.arenaResets[i] = arenas[i]->resets;
+		s.arenaTotalAllocations[i] = arenas[i]->totalAllocations;
+		s.arenaBytes[i] = arenas[i]->bytes;
+		s.arenaReserved[i] = arenas[i]->reserved;
+	}
+	
+	SDL_AtomicIncRef(&statsSegment->sequence);
+	SDL_MemoryBarrierRelease();
+	memcpy(&statsSegment->stats, &s, sizeof(s));
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicIncRef(&statsSegment->sequence);
+}
+
+/**
+ * Copies a consistent snapshot of the statistics of segment. Returns false
+ * if the game didn't finish writing them for a while, as if it crashed.
+ **/
+bool stats_snapshot(stats_segment_t const *segment, stats_t *s)
+{
+	// a plain load, the segment is mapped read only
+	volatile int const *sequence = &segment->sequence.value;
+	for(int tries = 0; tries < 1000; tries++) {
+		int before = *sequence;
+		if(before & 1) {
+			SDL_Delay(1);
+			continue;
 		}
-		else if(a < 15.0) {
-			a = 15.0;
-			d = 1;
+		SDL_MemoryBarrierAcquire();
+		memcpy(s, (void const *)&segment->stats, sizeof(*s));
+		SDL_MemoryBarrierAcquire();
+		if(*sequence == before) {
+			return true;
 		}
 	}
+	return false;
 }
 
-void endscreen(SDL_Texture *tex)
+void stats_print(stats_t const *s)
 {
-	isGameRunning = false;
+	printf("frame=%llu phase=%s frame_ms=%.2f tick_ms=%.3f ticks=%llu projectiles=%u trail_points=%u affectors=%u turn=%u lifepoints=%d,%d matches=%u wins=%u,%u desyncs=%u",
+		(unsigned long long)s->frames,
+		s->phase < STATS_PHASE_COUNT ? statsPhaseNames[s->phase] : "?",
+		s->frameMs, s->tickMs, (unsigned long long)s->ticks,
+		s->projectiles, s->trailPoints, s->affectors, s->turn,
+		s->lifepoints[0], s->lifepoints[1],
+		s->matches, s->wins[0], s->wins[1], s->desyncs);
+	const char *names[] = { "level", "match", "turn" };
+	for(int i = 0; i < 3; i++) {
+		printf(" %s_arena=%u/%llu/%llu/%llu/%u", names[i],
+			s->arenaAllocations[i], (unsigned long long)s->arenaTotalAllocations[i],
+			(unsigned long long)s->arenaBytes[i], (unsigned long long)s->arenaReserved[i],
+			s->arenaResets[i]);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/**
+ * Input latency: the time from the timestamp of an input event to the
+ * return of the SDL_RenderPresent() that shows its result. latency_input()
+ * marks an event, frame_present() presents and books the oldest marked
+ * event of each kind into a histogram with 1 ms buckets.
+ * F3 shows the histograms while building, aiming and in battle.
+ *
+ * frame_wait() delays the input sampling of the next frame as close to its
+ * present as the time the last frames needed to render allows.
+ **/
+#define LATENCY_BUCKETS 64 // the last bucket holds everything longer
+#define FRAME_PERIOD_MS 15 // without vsync
+#define FRAME_MARGIN_US 2000
+
+enum {
+	LATENCY_LAUNCH, // fire while aiming -> first frame of the battle
+	LATENCY_BUILD,  // mouse and keys while building -> frame showing them
+	LATENCY_KINDS,
+};
+
+struct {
+	bool overlay;
+	uint32_t pending[LATENCY_KINDS]; // timestamp of the oldest event + 1, 0 if none
+	uint32_t histogram[LATENCY_KINDS][LATENCY_BUCKETS];
+	uint32_t count[LATENCY_KINDS];
 	
-	SDL_Rect fullscreen = {
-		0, 0,
-		1280, 720,
-	};
-	SDL_RenderCopy(
-		renderer,
-		tex,
-		NULL,
-		&fullscreen);
+	uint64_t period;      // performance counter ticks between two presents
+	uint64_t lastPresent;
+	uint64_t sampled;     // when the input of the current frame was sampled
+	uint64_t renderCost;  // recent maximum of sampled -> present
+} latency;
+
+void latency_input(int kind, SDL_Event const *e)
+{
+	if(latency.pending[kind] == 0) {
+		latency.pending[kind] = e->common.timestamp + 1;
+	}
+}
+
+/**
+ * Toggles the overlay on F3.
+ **/
+void latency_event(SDL_Event const *e)
+{
+	if(e->type == SDL_KEYDOWN && e->key.keysym.sym == SDLK_F3 && e->key.repeat == 0) {
+		latency.overlay = !latency.overlay;
+	}
+}
+
+/**
+ * Waits until the input of the next frame has to be sampled and starts
+ * measuring its render time.
+ **/
+void frame_wait()
+{
+	uint64_t freq = SDL_GetPerformanceFrequency();
+	if(latency.period == 0) {
+		SDL_RendererInfo info;
+		SDL_DisplayMode mode;
+		latency.period = freq * FRAME_PERIOD_MS / 1000;
+		if(SDL_GetRendererInfo(renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC) &&
+		   SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) {
+			latency.period = freq / mode.refresh_rate;
+		}
+	}
+	
+	uint64_t margin = freq * FRAME_MARGIN_US / 1000000;
+	if(latency.lastPresent != 0 && latency.renderCost + margin < latency.period) {
+		uint64_t target = latency.lastPresent + latency.period - latency.renderCost - margin;
+		uint64_t now = SDL_GetPerformanceCounter();
+		if(target > now && target - now > freq / 500) {
+			SDL_Delay((target - now) * 1000 / freq - 1);
+		}
+		while(SDL_GetPerformanceCounter() < target) {
+			; // BURN!
+		}
+	}
+	latency.sampled = SDL_GetPerformanceCounter();
+}
+
+/**
+ * Presents the frame and books the marked input events.
+ **/
+void frame_present()
+{
+	uint64_t start = SDL_GetPerformanceCounter();
+	if(latency.sampled != 0) {
+		uint64_t cost = start - latency.sampled;
+		latency.renderCost = MAX(cost, latency.renderCost - latency.renderCost / 32);
+		latency.sampled = 0;
+	}
 	
 	SDL_RenderPresent(renderer);
-		
-	while(true)
-	{
-		SDL_Event e;
-		while(SDL_PollEvent(&e))
-		{
-			if(e.type == SDL_QUIT) exit(1);
-			if(e.type == SDL_KEYDOWN) return;
-			if(e.type == SDL_MOUSEBUTTONUP) return;
+	uint64_t now = SDL_GetPerformanceCounter();
+	if(latency.lastPresent != 0) {
+		gameStats.frameMs = (now - latency.lastPresent) * 1000.0 / SDL_GetPerformanceFrequency();
+	}
+	latency.lastPresent = now;
+	gameStats.frames += 1;
+	
+	uint32_t ticks = SDL_GetTicks();
+	for(int i = 0; i < LATENCY_KINDS; i++) {
+		if(latency.pending[i] == 0) {
+			continue;
 		}
+		uint32_t ms = ticks - (latency.pending[i] - 1);
+		latency.histogram[i][MIN(ms, LATENCY_BUCKETS - 1)] += 1;
+		latency.count[i] += 1;
+		latency.pending[i] = 0;
+	}
 	
-		SDL_Delay(16);
+	stats_publish();
+}
+
+/**
+ * Draws a number with the digits of texNumbers, right aligned to x.
+ **/
+void render_number(unsigned value, int x, int y, int size)
+{
+	do {
+		x -= size;
+		SDL_Rect src = { 16 * (value % 10), 0, 16, 16 };
+		SDL_Rect target = { x, y, size, size };
+		SDL_RenderCopy(renderer, texNumbers, &src, &target);
+		value /= 10;
+	} while(value > 0);
+}
+
+/**
+ * Draws the latency histograms into the upper left corner of the
+ * battleground: launches on top, building below. Every bar is a millisecond,
+ * the red line marks a frame. The numbers are the median, the 99th
+ * percentile and the number of events.
+ **/
+void latency_render()
+{
+	if(latency.overlay == false) {
+		return;
+	}
+	
+	int frameMs = latency.period * 1000 / SDL_GetPerformanceFrequency();
+	SDL_Rect box = { battleground.x + 8, 8, 3 * LATENCY_BUCKETS + 8 + 3 * 40, LATENCY_KINDS * 56 + 8 };
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 192);
+	SDL_RenderFillRect(renderer, &box);
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+	
+	for(int i = 0; i < LATENCY_KINDS; i++) {
+		int x = box.x + 4;
+		int bottom = box.y + 4 + 56 * i + 48;
+		uint32_t const *histogram = latency.histogram[i];
+		
+		uint32_t highest = 1;
+		for(int b = 0; b < LATENCY_BUCKETS; b++) {
+			highest = MAX(highest, histogram[b]);
+		}
+		
+		SDL_SetRenderDrawColor(renderer, 255, 64, 64, 255);
+		SDL_RenderDrawLine(renderer, x + 3 * frameMs, bottom - 48, x + 3 * frameMs, bottom);
+		
+		int median = -1, p99 = -1;
+		uint32_t sum = 0;
+		for(int b = 0; b < LATENCY_BUCKETS; b++) {
+			sum += histogram[b];
+			if(median < 0 && 2 * sum >= latency.count[i] && sum > 0) {
+				median = b;
+			}
+			if(p99 < 0 && 100 * (uint64_t)sum >= 99 * (uint64_t)latency.count[i] && sum > 0) {
+				p99 = b;
+			}
+			if(histogram[b] == 0) {
+				continue;
+			}
+			SDL_Rect bar = { x + 3 * b, bottom - MAX(1, 48 * histogram[b] / highest), 2, 0 };
+			bar.h = bottom - bar.y;
+			SDL_SetRenderDrawColor(renderer, 192, 192, 192, 255);
+			SDL_RenderFillRect(renderer, &bar);
+		}
+		
+		int right = box.x + box.w - 4;
+		render_number(latency.count[i], right, bottom - 12, 12);
+		if(latency.count[i] > 0) {
+			render_number(p99, right, bottom - 28, 12);
+			render_number(median, right, bottom - 44, 12);
+		}
 	}
 }
 
-void battle_simulation()
+/**
+ * The aiming sweeps from 15° to 165° and back, starting at 15°.
+ * Returns the angle seconds after the start of the sweep.
+ **/
+float aim_angle(double seconds)
 {
-	SDL_Event e;
-	uint32_t nextFrameTime = 0;
+	double angularSpeed = 90.0;
+	if(gameOptions.useSlowAiming) {
+		angularSpeed = 45.0;
+	}
+	double sweep = fmod(angularSpeed * MAX(seconds, 0.0), 300.0);
+	if(sweep > 150.0) {
+		sweep = 300.0 - sweep;
+	}
+	return 15.0 + sweep;
+}
+
+bool player_aim(base_t *player, float *angle)
+{
+	uint64_t lastFrame = SDL_GetPerformanceCounter();
 	
-	base_t * currentPlayer = &leftBase;
+	// The angle only depends on the time since the sweep started, so a
+	// launch gets the angle of the moment of the press, not of the last frame.
+	uint64_t freq = SDL_GetPerformanceFrequency();
+	uint64_t sweepStart = SDL_GetPerformanceCounter();
+	uint32_t sweepStartTicks = SDL_GetTicks(); // event timestamps are in ticks
+	gameStats.phase = STATS_PHASE_AIM;
 	
 	while(true)
 	{
-		float dt = 1.0 / 60.0;
+		frame_wait();
 		
-		// first, tick all particles
-		for(particle_t * p = particles, *prev = NULL; p != NULL; )
+		SDL_Event e;
+		while(SDL_PollEvent(&e))
 		{
-			// progress the particle
-			p->progress += 2;
+			latency_event(&e);
+			if(e.type == SDL_QUIT) exit(0);
+			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) return false;
 			
-			// this is fancy deletion code.
-			if(p->progress >= 200) {
-				// remove the particle here:
-				if(prev != NULL) {
-					prev->next = p->next;
-				}
-				if(p == particles) {
-					particles = p->next;
-				}
-				{
-					particle_t *k = p;
-					p = p->next;
-					free(k);
-				}
-			} else {
-				prev = p;
-				p = p->next;
-			}
-		}
-		
-		// second: tick all projectiles
-		bool anyProjectileAlive = false;
-		for(projectile_t *p = projectiles; p != NULL; p = p->next)
-		{
-			if(p->active == false) {
-				continue;
-			}
-			// disable all out-of-screen projectiles
-			if(p->pos.x < -10 || p->pos.y < -10) {
-				p->active = false;
-			}
-			if(p->pos.x >= (battleground.w + 10) || p->pos.y >= (battleground.h + 10)) {
-				p->active = false;
-			}
-			
-			float2 leftBasePos = { 0, battleground.h / 2 };
-			float2 rightBasePos = { battleground.w, battleground.h / 2 };
-			
-			if(distance(p->pos, leftBasePos) <= 126) {
-				Mix_PlayChannel(-1, sndImpactBase, 0);
-				// hit left base
-				leftBase.lifepoints--;
-				if(leftBase.lifepoints < 0) {
-					endscreen(texFinalGreen);
-					return;
-				}
-				p->active = false;
-			}
-			if(distance(p->pos, rightBasePos) <= 126) {
-				Mix_PlayChannel(-1, sndImpactBase, 0);
-				// hit right base
-				rightBase.lifepoints--;
-				if(rightBase.lifepoints < 0) {
-					endscreen(texFinalBlue);
-					return;
-				}
-				p->active = false;
-			}
-			
-			if(p->active == false) {
-				continue;
-			}
-			
-			float2 accel = { 0 };
-			
-			for(affector_t *a = affectors; a != NULL; a = a->next)
-			{
-				if(a->type < 0) {
-					// ignore all destroyed affectors.
-					continue;
-				}
-				float2 dst = {
-					p->pos.x - a->center.x,
-					p->pos.y - a->center.y,
-				};
-				float len = length(dst);
-				dst.x /= len;
-				dst.y /= len;
-				
-				if(len <= 16) { // 32 diameter
-					// we crashen in an affector
-					
-					if(a->lifepoints > 0 && a->type >= 2 && a->type <= 4) {
-						// and this affector is a booster
-						
-						int offset[] = { 0, -45, 45 };
-						int len = 0;
-						float speed = length(p->vel);
-						switch(a->type) {
-							case 2: 
-								len = 1; 
-								speed *= 1.5;
-								Mix_PlayChannel(-1, sndBoost, 0);
-								break;
-							case 3: 
-								Mix_PlayChannel(-1, sndSplit3, 0);
-								len = 3; 
-								break;
-							case 4:
-								Mix_PlayChannel(-1, sndSplit2, 0);
-								len = 2; 
-								offset[0] = -30;
-								offset[1] =  30;
-								break;
-						}
-						
-						for(int i = 0; i < len; i++) {
-							float2 dir = {
-								24 * cos(DEG_TO_RAD(a->rotation + offset[i])),
-								24 * sin(DEG_TO_RAD(a->rotation + offset[i])),
-							};
-							
-							float2 xvel = dir;
-							xvel.x *= speed / 24;
-							xvel.y *= speed / 24;
-							
-							anyProjectileAlive = true;
-							fire_projectile(
-								p->base, 
-								(float2){ a->center.x + dir.x, a->center.y + dir.y }, 
-								xvel);
-						}
-					}
-					
-					a->lifepoints -= 1;
-					
-					if(a->lifepoints <= 0) {
-						a->type = -1; // Destroy the affector.
-					}
-					
-					p->active = false;
-					break;
-				}
-				
-				if(len <= 0) {
-					continue;
-				}
-				
-				float strength = 2000.0 / len;
-				strength *= strength;
-				
-				dst.x *= strength;
-				dst.y *= strength;
-				
-				switch(a->type) {
-					case 0:
-						accel.x -= dst.x;
-						accel.y -= dst.y;
-						break;
-					case 1:
-						accel.x += dst.x;
-						accel.y += dst.y;
-						break;
-				}
-			}
-			
-			float2 vel = p->vel;
-			vel.x += accel.x * dt;
-			vel.y += accel.y * dt;
-			
-			float2 delta = {
-				vel.x * dt,
-				vel.y * dt,
-			};
-			float2 newPos = {
-				p->pos.x + delta.x,
-				p->pos.y + delta.y,
-			};
-			
-			// check collision against blocks
-			for(block_t *b = blockchain; b != NULL; b = b->next)
-			{
-				SDL_Rect rect = b->rect;
-				
-				bool hit = check_collision(
-						p->pos,
-						newPos,
-						(float2){ rect.x, rect.y },
-						(float2){ rect.w, rect.h },
-						0.0);
-				
-				if(hit) {
-					p->active = false;
-					Mix_PlayChannel(-1, sndImpactWall, 0);
-					break;
-				}
-			}
-			
-			if(p->active)
-			{
-				// check collision against protectors
-				for(int i = 0; i < 24; i++) {
-					int baseRadius = 136;
-				
-					// left base
-					if(leftBase.protectors[i] > 0) {
-						SDL_Rect target = {
-							baseRadius * sinf(DEG_TO_RAD(15 * i - PROTECTOR_OFFSET)) - 6,
-							battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(15 * i - PROTECTOR_OFFSET)) - 15,
-							12,
-							30,
-						};
-						float a = -15 * i - 90 + PROTECTOR_OFFSET;
-						
-						bool hit = check_collision(
-							p->pos,
-							newPos,
-							(float2){ target.x, target.y },
-							(float2){ target.w, target.h },
-							a);
-						if(hit != false) {
-							leftBase.protectors[i] -= 1;
-							Mix_PlayChannel(-1, sndImpactBarricade, 0);
-							p->active = false;
-							break;
-						}
-					}
-					
-					if(rightBase.protectors[i] > 0) {
-						SDL_Rect target = {
-							battleground.w - baseRadius * sinf(DEG_TO_RAD(15 * i + PROTECTOR_OFFSET)) - 6,
-							battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(15 * i + PROTECTOR_OFFSET)) - 15,
-							12,
-							30,
-						};
-						float a = 15 * i - 90 + PROTECTOR_OFFSET;
-						bool hit = check_collision(
-							p->pos,
-							newPos,
-							(float2){ target.x, target.y },
-							(float2){ target.w, target.h },
-							a);
-						if(hit != false) {
-							rightBase.protectors[i] -= 1;
-							Mix_PlayChannel(-1, sndImpactBarricade, 0);
-							p->active = false;
-							break;
-						}
-					}
-				}
-			}
-			
-			// Spawn particles on the way of moving, even if we aren't active any more
-			float rot = 90 - RAD_TO_DEG(atan2(p->vel.x, p->vel.y));
-			int cnt = 3 + sqrt(delta.x*delta.x + delta.y*delta.y);
-			for(int i = 0; i < cnt; i++) {
-				float2 ppos = {
-					p->pos.x + i * delta.x / (cnt - 1),
-					p->pos.y + i * delta.y / (cnt - 1),
-				};
-				spawn_particle(p->base, ppos.x, ppos.y, rot);
-			}
-			
-			if(p->active == false) {
-				continue;
-			}
-			
-			anyProjectileAlive = true;
-			
-			p->vel = vel;
-			p->pos.x += delta.x;
-			p->pos.y += delta.y;
-		}
-		
-		if(anyProjectileAlive == false) {
-			return;
-		}
-	
-		while(SDL_PollEvent(&e))
-		{
-			if(e.type == SDL_QUIT) exit(1);
-			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) {
-				isGameRunning = false;
-				return;
+			if((e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_SPACE) ||
+			   (e.type == SDL_MOUSEBUTTONDOWN)) {
+				latency_input(LATENCY_LAUNCH, &e);
+				int32_t ms = (int32_t)(e.common.timestamp - sweepStartTicks);
+				*angle = aim_angle(ms / 1000.0);
+				return true;
 			}
 		}
 		
@@ -1327,774 +2670,6034 @@ void battle_simulation()
 		SDL_RenderClear(renderer);
 		
 		render_battleground();
+		battleTime += frame_time(&lastFrame);
 		
-		{ // Draw closed tool panels
-			SDL_Rect leftPanel = {
-				0, 0, 128, 720
-			};
-			SDL_RenderCopy(
-				renderer,
-				texLeftPanel,
-				NULL,
-				&leftPanel);
-				
-			SDL_Rect rightPanel = {
-				battleground.x + battleground.w, 0, 128, 720
-			};
-			SDL_RenderCopy(
-				renderer,
-				texRightPanel,
-				NULL,
-				&rightPanel);
+		// show the angle of the moment the frame will be presented
+		uint64_t presentAt = SDL_GetPerformanceCounter() + latency.renderCost;
+		render_aim_preview(player, aim_angle((double)(presentAt - sweepStart) / freq));
+		
+		
+		render_tool_panels(NULL);
+		latency_render();
+		
+		spectate_flush();
+		
+		frame_present();
+	}
+}
+
+/**
+ * Fires the projectile of a player in the direction of angle (degrees).
+ **/
+void launch_projectile(base_t *player, float angle)
+{
+	int baseRadius = 155;
+	
+	affectorPack.valid = false;
+	if(gameOptions.fixedPoint) {
+		for(int i = 0; i < affectorCount; i++) {
+			affector_t *a = &affectors[i];
+			a->fxCenter = fx_from_float2(a->center);
+			a->fxRotation = FX(a->rotation);
 		}
 		
-		SDL_RenderPresent(renderer);
-			
-		while(SDL_GetTicks() < nextFrameTime) {
-			; // BURN!
+		fixed_t s = fx_sin(FX(angle));
+		fixed_t c = fx_cos(FX(angle));
+		fixed2 pos = {
+			baseRadius * s - FX(6),
+			FX(battleground.h / 2) + baseRadius * c - FX(6),
+		};
+		fixed2 vel = { 250 * s, 250 * c };
+		if(player == &rightBase) {
+			pos.x = FX(battleground.w) - baseRadius * s - FX(6);
+			vel.x = -vel.x;
 		}
-		nextFrameTime = SDL_GetTicks() + 15;
+		audio_emit(SND_LAUNCH);
+		fx_fire_projectile(player, pos, vel);
+		return;
 	}
-
+	
+	float2 pos, vel;
+	if(player == &leftBase) {
+		pos = (float2){
+			baseRadius * sinf(DEG_TO_RAD(angle)) - 6,
+			battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(angle)) - 6,
+		};
+		vel = (float2) {
+			sinf(DEG_TO_RAD(angle)),
+			cosf(DEG_TO_RAD(angle)),
+		};
+	} else {
+		pos = (float2) {
+			battleground.w - baseRadius * sinf(DEG_TO_RAD(angle)) - 6,
+			battleground.h / 2 + baseRadius * cosf(DEG_TO_RAD(angle)) - 6,
+		};
+		vel = (float2){
+			-sinf(DEG_TO_RAD(angle)),
+			cosf(DEG_TO_RAD(angle)),
+		};
+	}
+	vel.x *= 250;
+	vel.y *= 250;
+	
+	audio_emit(SND_LAUNCH);
+	fire_projectile(player, pos, vel);
 }
 
-void battle_reset()
+void endscreen(SDL_Texture *tex)
 {
-	for(projectile_t *p = projectiles; p != NULL; )
+	isGameRunning = false;
+	
+	SDL_Rect fullscreen = {
+		0, 0,
+		1280, 720,
+	};
+	SDL_RenderCopy(
+		renderer,
+		tex,
+		NULL,
+		&fullscreen);
+	
+	frame_present();
+	audio_flush();
+	
+	if(netBot) {
+		SDL_Delay(1000);
+		return;
+	}
+		
+	while(true)
 	{
-		projectile_t *k = p;
-		p = p->next;
-		free(k);
+		SDL_Event e;
+		while(SDL_PollEvent(&e))
+		{
+			if(e.type == SDL_QUIT) exit(1);
+			if(e.type == SDL_KEYDOWN) return;
+			if(e.type == SDL_MOUSEBUTTONUP) return;
+		}
+		
+		spectate_flush();
+		SDL_Delay(16);
 	}
-	projectiles = NULL;
+}
+
+/**
+ * Projectile integration.
+ * Projectiles are moved with velocity verlet and adaptive substeps: a substep
+ * never moves a projectile further than SIM_MAX_STEP pixels and never changes
+ * its velocity by more than SIM_MAX_TURN of its speed. Slow projectiles in
+ * empty space cross a whole tick in one step, fast ones or ones close to
+ * an affector get as many substeps as they need (up to SIM_MAX_SUBSTEPS).
+ **/
+#define SIM_MAX_STEP      8.0f
+#define SIM_MAX_TURN      0.1f
+#define SIM_MAX_SUBSTEPS  64
+#define SIM_MIN_SPEED     25.0f
+
+#define AFFECTOR_RADIUS   16.0f
+
+/**
+ * Plays a sound effect caused by the simulation.
+ **/
+void sim_sound(int snd)
+{
+	if(simulateEffects) {
+		audio_emit(snd);
+	}
+}
+
+/**
+ * The acceleration of weight field affectors at center on pos, the
+ * weight is negative for pulling (positive) affectors.
+ **/
+static inline float2 field_force(float2 pos, float2 center, float weight)
+{
+	float2 dst = {
+		pos.x - center.x,
+		pos.y - center.y,
+	};
+	float len = length(dst);
 	
+	float strength = 2000.0 / len;
+	strength *= strength;
+	strength /= len;
+	// no force right on the center
+	strength = (len > 0) ? strength * weight : 0.0f;
 	
-	if(gameOptions.affectorsStay) {
-		affector_t *it = affectors;
-		affector_t *prev = NULL;
-		while(it != NULL)
-		{
-			if(it->type >= 0) {
-				// Just skip
-				prev = it;
-				it = it->next;
-			} else {
-				// delete entry
-				if(prev == NULL) {
-					affectors = it->next;
+	return (float2){ dst.x * strength, dst.y * strength };
+}
+
+/**
+ * Barnes-Hut approximation of field_acceleration(): cells that look
+ * smaller than the opening angle from pos act like one affector of each
+ * sign at the centroids, closer ones are opened and leaves summed up.
+ *
+ * Pulling and pushing affectors mostly cancel, so the error is large
+ * compared to the net field. Relative error against the exact sum (median
+ * / 99th percentile over random positions on the battleground) and
+ * speedup for 1000 and 3000 random affectors:
+ *   theta 0.3: 0.4% / 3.4%, 1.3x   0.8% /  9.5%,  4.6x
+ *   theta 0.5: 1.4% / 13%,  2.1x   2.2% / 20%,    8.9x
+ *   theta 1.0: 4.5% / 56%,  3.8x   6.6% / 57%,   19x
+ * Below a few hundred affectors the tree is slower than the exact sum.
+ **/
+static float2 field_tree_acceleration(affector_pack_t const *pack, float2 pos)
+{
+	float theta = gameOptions.fieldTheta / 1000.0f;
+	float2 accel = { 0 };
+	int stack[4 * FIELD_TREE_DEPTH];
+	int top = 0;
+	if(pack->nodeCount > 0) {
+		stack[top++] = 0;
+	}
+	while(top > 0)
+	{
+		field_node_t const *node = &pack->nodes[stack[--top]];
+		float size = (float)node->size / FX_ONE;
+		float2 mid = {
+			(float)(node->min.x + node->size / 2) / FX_ONE,
+			(float)(node->min.y + node->size / 2) / FX_ONE,
+		};
+		// measured to the circle around the cell, so no affector is closer
+		if(size < theta * (distance(pos, mid) - 0.7072f * size)) {
+			for(int s = 0; s < 2; s++) {
+				if(node->mass[s] > 0) {
+					float2 f = field_force(pos, node->center[s], (s ? 1.0f : -1.0f) * node->mass[s]);
+					accel.x += f.x;
+					accel.y += f.y;
 				}
-				
-				affector_t *tmp = it;
-				it = it->next;
-				free(tmp);
-				
-				if(prev != NULL) {
-					prev->next = it;
+			}
+		} else if(node->leaf) {
+			for(int i = node->first; i < node->first + node->count; i++) {
+				int f = pack->order[i];
+				float2 force = field_force(pos, (float2){ pack->fieldX[f], pack->fieldY[f] }, pack->fieldSign[f]);
+				accel.x += force.x;
+				accel.y += force.y;
+			}
+		} else {
+			for(int q = 0; q < 4; q++) {
+				if(node->children[q] >= 0) {
+					stack[top++] = node->children[q];
 				}
 			}
 		}
-	
-	} else {
-		for(affector_t *p = affectors; p != NULL; )
-		{
-			affector_t *k = p;
-			p = p->next;
-			free(k);
-		}
-		affectors = NULL;
 	}
+	return accel;
 }
 
-void player_build(base_t *player)
+/**
+ * Returns the acceleration the field affectors (positive and negative)
+ * apply on a projectile at pos.
+ **/
+float2 field_acceleration(float2 pos)
 {
-	int draggingAffector = -1;
-	
-	SDL_Event e;
-	uint32_t nextFrameTime = 0;
-	
-	affector_t *currentAffector = NULL;
-	
-	bool isRotating = true;
-	int isMoving = 0;
+	affector_pack_t const *pack = affector_pack();
+	if(gameOptions.fieldTheta > 0) {
+		return field_tree_acceleration(pack, pos);
+	}
+	float2 accel = { 0 };
+	for(int i = 0; i < pack->fieldCount; i++)
+	{
+		float2 f = field_force(pos, (float2){ pack->fieldX[i], pack->fieldY[i] }, pack->fieldSign[i]);
+		accel.x += f.x;
+		accel.y += f.y;
+	}
+	return accel;
+}
+
+/**
+ * Returns the first affector the segment from-to passes through or NULL.
+ * Tests the whole segment so fast projectiles can't tunnel through.
+ **/
+affector_t *affector_contact(float2 from, float2 to)
+{
+	float2 seg = {
+		to.x - from.x,
+		to.y - from.y,
+	};
+	float segLen2 = seg.x*seg.x + seg.y*seg.y;
 	
-	while(true)
+	// every affector is solid, not only the boosters and splitters
+	affector_pack_t const *pack = affector_pack();
+	int hit = -1;
+	float hitT = 2.0;
+	float invLen2 = (segLen2 > 0) ? 1.0f : 0.0f;
+	float den = (segLen2 > 0) ? segLen2 : 1.0f;
+	for(int i = 0; i < pack->count; i++)
 	{
-		float dt = 1.0 / 60.0;
+		float t = ((pack->x[i] - from.x) * seg.x + (pack->y[i] - from.y) * seg.y) / den * invLen2;
+		t = MAX(0.0, MIN(1.0, t));
+		float2 dst = {
+			from.x + t * seg.x - pack->x[i],
+			from.y + t * seg.y - pack->y[i],
+		};
+		bool closer = (dst.x*dst.x + dst.y*dst.y) <= (AFFECTOR_RADIUS * AFFECTOR_RADIUS) && t < hitT;
+		hit = closer ? i : hit;
+		hitT = closer ? t : hitT;
+	}
+	return (hit >= 0) ? &affectors[hit] : NULL;
+}
+
+/**
+ * Rolling hash of the battle, so two simulations of a turn can be compared
+ * tick by tick. battle_tick() mixes in the projectiles it moves, damage to
+ * affectors, protectors and bases is mixed in where it happens, so the
+ * cost doesn't grow with the number of affectors. Everything that doesn't
+ * change during a battle is covered by state_hash() at the start of the turn.
+ **/
+#define BATTLE_HASH_PROTECTOR 0x10000 // + 24 * side + index
+#define BATTLE_HASH_BASE      0x20000 // + side
+#define BATTLE_HASH_AFFECTOR  0x30000 // + slot, see affectors_renumber()
+
+static inline uint32_t rotl32(uint32_t x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+static inline void battle_hash(uint32_t x)
+{
+	battleHash = rotl32((battleHash ^ x) * 16777619u, 13);
+}
+
+static inline void battle_hash_event(uint32_t key, int value)
+{
+	battle_hash(key);
+	battle_hash((uint32_t)value);
+}
+
+/**
+ * Folds the state of a projectile into one word. battle_tick() sums them
+ * up for the projectiles it moved and mixes the sum in once per tick.
+ **/
+static inline uint32_t projectile_hash(projectile_t const *p)
+{
+	uint32_t w[4];
+	if(gameOptions.fixedPoint) {
+		// positions and velocities fit into the low 32 bits
+		w[0] = (uint32_t)p->fxPos.x;
+		w[1] = (uint32_t)p->fxPos.y;
+		w[2] = (uint32_t)p->fxVel.x;
+		w[3] = (uint32_t)p->fxVel.y;
+	} else {
+		memcpy(&w[0], &p->pos.x, sizeof(float));
+		memcpy(&w[1], &p->pos.y, sizeof(float));
+		memcpy(&w[2], &p->vel.x, sizeof(float));
+		memcpy(&w[3], &p->vel.y, sizeof(float));
+	}
+	return w[0] ^ rotl32(w[1], 8) ^ rotl32(w[2], 16) ^ rotl32(w[3], 24) ^ ((uint32_t)p->id << 4);
+}
+
+/**
+ * A projectile crashed into an affector: boost or split it and damage the affector.
+ **/
+void affector_crash(projectile_t *p, affector_t *a)
+{
+	if(a->lifepoints > 0 && a->type >= 2 && a->type <= 4) {
+		// and this affector is a booster
 		
-		while(SDL_PollEvent(&e))
-		{
-			if(e.type == SDL_QUIT) exit(0);
-			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) {
-				isGameRunning = false;
-				return;
+		int offset[] = { 0, -45, 45 };
+		int len = 0;
+		bool boost = false;
+		switch(a->type) {
+			case 2: 
+				len = 1; 
+				boost = true;
+				sim_sound(SND_BOOST);
+				break;
+			case 3: 
+				sim_sound(SND_SPLIT3);
+				len = 3; 
+				break;
+			case 4:
+				sim_sound(SND_SPLIT2);
+				len = 2; 
+				offset[0] = -30;
+				offset[1] =  30;
+				break;
+		}
+		
+		if(gameOptions.fixedPoint) {
+			fixed2 center = a->fxCenter;
+			fixed_t speed = fx_length(p->fxVel);
+			if(boost) {
+				speed = speed * 3 / 2;
 			}
-			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_SPACE) return;
-			
-			if(e.type == SDL_MOUSEBUTTONDOWN)
-			{
-				SDL_Rect target = {
-					32, 32, 64, 64
-				};
-				if(player == &rightBase) {
-					target.x += battleground.x;
-					target.x += battleground.w;
-				}
-				draggingAffector = -1;
-				for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
-					int count = player->resources[i];
-					if(count <= 0) {
-						continue;
-					}
-					
-					if(e.button.x >= target.x && e.button.y >= target.y &&
-					   e.button.x < (target.x + target.w) &&
-						 e.button.y < (target.y + target.h))
-					{
-						draggingAffector = i;
-						break;
-					}
-				
-					target.y += 96;
-				}
-				
-				if(draggingAffector < 0)
-				{
-					// Check for dragging the move point
-					if(currentAffector != NULL)
-					{							
-						float2 pos = {
-							48 * cosf(DEG_TO_RAD(-currentAffector->rotation)),
-							-48 * sinf(DEG_TO_RAD(-currentAffector->rotation)),
-						};
-						pos.x += currentAffector->center.x;
-						pos.y += currentAffector->center.y;
-						
-						SDL_Rect grabbag = {
-							battleground.x + pos.x - 6, pos.y - 6,
-							12, 12
-						};
-						
-						if(e.button.x >= grabbag.x && e.button.y >= grabbag.y &&
-					   e.button.x < (grabbag.x + grabbag.w) &&
-						 e.button.y < (grabbag.y + grabbag.h))
-						{
-							isRotating = true;
-						}
-						
-						float2 delta = {
-							e.button.x - currentAffector->center.x - battleground.x,
-							e.button.y - currentAffector->center.y,
-						};
-						if(length(delta) < 16) {
-							isMoving = 1;
-							SDL_SetRelativeMouseMode(SDL_TRUE);
-						}
-						
-						if(length(delta) > 64) {
-							isMoving = 0;
-							isRotating = false;
-							SDL_SetRelativeMouseMode(SDL_FALSE);
-							currentAffector = NULL;
-						}
-					}
-					// No else-if: Allows reselection of other affectors.
-					if(currentAffector == NULL)
-					{
-						float minDist = 16;
-						for(affector_t *p = affectors; p != NULL; p = p->next)
-						{
-							if(p->owner != player) {
-								continue;
-							}
-							float2 pos = {
-								battleground.x + p->center.x,
-								p->center.y,
-							};
-							pos.x -= e.button.x;
-							pos.y -= e.button.y;
-							float l = length(pos);
-							if(l > minDist) {
-								continue;
-							}
-							l = minDist;
-							currentAffector = p;
-						}
-					}
-				}
+			for(int i = 0; i < len; i++) {
+				fixed_t rot = a->fxRotation + offset[i] * FX_ONE;
+				fixed_t c = fx_cos(rot);
+				fixed_t s = fx_sin(rot);
+				fx_fire_projectile(
+					p->base,
+					(fixed2){ center.x + 24 * c, center.y + 24 * s },
+					(fixed2){ FX_MUL(c, speed), FX_MUL(s, speed) });
 			}
-			
-			if(e.type == SDL_MOUSEBUTTONUP)
-			{
-				if(draggingAffector >= 0) {
-					fprintf(stderr, "%d,%d,%d\n", e.button.x, battleground.x, battleground.w);
-					if(e.button.x >= battleground.x && e.button.x < (battleground.x + battleground.w)) {
-						affector_t *a = create_affector(player, draggingAffector, (float2){e.button.x - 128, e.button.y});
-						if(player == &rightBase) {
-							a->rotation = 180;
-						}
-						currentAffector = a;
-						player->resources[draggingAffector] -= 1;
-					}
-					draggingAffector = -1;
-				}
-				
-				if(isRotating) {
-					isRotating = false;
-				}
-				if(isMoving) {
-					if(currentAffector != NULL && (e.button.x <= battleground.x || e.button.x > (battleground.x + battleground.w))) {
-						player->resources[currentAffector->type] += 1; // return affector to inventory
-						currentAffector->type = -1;
-						currentAffector->center.x = -100000;
-					}
-					isMoving = 0;
-					SDL_SetRelativeMouseMode(SDL_FALSE);
-				}
-				
-				SDL_Rect button = {
-					16, 668,
-					96, 36
+		} else {
+			float speed = length(p->vel);
+			if(boost) {
+				speed *= 1.5;
+			}
+			for(int i = 0; i < len; i++) {
+				float2 dir = {
+					24 * cos(DEG_TO_RAD(a->rotation + offset[i])),
+					24 * sin(DEG_TO_RAD(a->rotation + offset[i])),
 				};
-				if(player == &rightBase) {
-					button.x += battleground.x + battleground.w;
-				}
-				if(e.button.x >= button.x && e.button.x < (button.x + button.w) &&
-					 e.button.y >= button.y && e.button.y < (button.y + button.h)) 
-				{
-					// On click: finish!
-					return;
-				}
 				
-				{ // Check for click on base:
-					float x = e.button.x - battleground.x;
-					if(player == &rightBase) {
-						x -= battleground.w;
-					}
-					float y = e.button.y - battleground.h/2;
-					
-					if((x*x+y*y) < (125*125))
-					{
-						if(player == &rightBase) {
-							if(x < 0) {
-								// Launch when click on base.
-								return;
-							}
-						}
-						if(player == &leftBase) {
-							if(x > 0) {
-								// Launch
-								return;
-							}
-						}
-					}
+				float2 xvel = dir;
+				xvel.x *= speed / 24;
+				xvel.y *= speed / 24;
+				
+				fire_projectile(
+					p->base, 
+					(float2){ a->center.x + dir.x, a->center.y + dir.y }, 
+					xvel);
+			}
+		}
+	}
+	
+	a->lifepoints -= 1;
+	battle_hash_event(BATTLE_HASH_AFFECTOR + a->slot, a->lifepoints);
+	
+	if(a->lifepoints <= 0) {
+		affector_remove(a); // Destroy the affector.
+	}
+}
+
+/**
+ * The protectors (12x30) sit on a circle with radius 136 around the bases,
+ * so they never reach out of this ring.
+ **/
+#define PROTECTOR_RING_INNER 119.0f
+#define PROTECTOR_RING_OUTER 153.0f
+
+static bool segment_near_ring(float2 from, float2 to, float2 center)
+{
+	float len = distance(from, to);
+	float d0 = distance(from, center);
+	float d1 = distance(to, center);
+	return (MIN(d0, d1) - len) <= PROTECTOR_RING_OUTER && MAX(d0, d1) >= PROTECTOR_RING_INNER;
+}
+
+/**
+ * Checks the segment from-to against blocks and protectors and
+ * applies the damage of a hit.
+ **/
+bool obstacle_collision(float2 from, float2 to)
+{
+	// check collision against blocks
+	for(block_t *b = blockchain; b != NULL; b = b->next)
+	{
+		SDL_Rect rect = b->rect;
+		
+		// cheap bounding box rejection first
+		if(MAX(from.x, to.x) < (rect.x - 1) || MIN(from.x, to.x) > (rect.x + rect.w + 1) ||
+		   MAX(from.y, to.y) < (rect.y - 1) || MIN(from.y, to.y) > (rect.y + rect.h + 1)) {
+			continue;
+		}
+		
+		bool hit = check_collision(
+				from,
+				to,
+				(float2){ rect.x, rect.y },
+				(float2){ rect.w, rect.h },
+				0.0);
+		
+		if(hit) {
+			battleWallHits += 1;
+			sim_sound(SND_IMPACT_WALL);
+			return true;
+		}
+	}
+	
+	// check collision against protectors
+	bool nearLeft = segment_near_ring(from, to, (float2){ 0, battleground.h / 2 });
+	bool nearRight = segment_near_ring(from, to, (float2){ battleground.w, battleground.h / 2 });
+	if(nearLeft == false && nearRight == false) {
+		return false;
+	}
+	protector_layout_t const *layout = protector_layout(PROTECTOR_OFFSET, &protectorLayout);
+	for(int i = 0; i < 24; i++) {
+		// left base
+		if(nearLeft && leftBase.protectors[i] > 0) {
+			SDL_Rect target = layout->rects[0][i];
+			bool hit = check_collision(
+				from,
+				to,
+				(float2){ target.x, target.y },
+				(float2){ target.w, target.h },
+				layout->angles[0][i]);
+			if(hit != false) {
+				leftBase.protectors[i] -= 1;
+				battle_hash_event(BATTLE_HASH_PROTECTOR + i, leftBase.protectors[i]);
+				sim_sound(SND_IMPACT_BARRICADE);
+				return true;
+			}
+		}
+		
+		if(nearRight && rightBase.protectors[i] > 0) {
+			SDL_Rect target = layout->rects[1][i];
+			bool hit = check_collision(
+				from,
+				to,
+				(float2){ target.x, target.y },
+				(float2){ target.w, target.h },
+				layout->angles[1][i]);
+			if(hit != false) {
+				rightBase.protectors[i] -= 1;
+				battle_hash_event(BATTLE_HASH_PROTECTOR + 24 + i, rightBase.protectors[i]);
+				sim_sound(SND_IMPACT_BARRICADE);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * Fixed point simulation, used when gameOptions.fixedPoint is set.
+ * The functions below mirror the float versions above, but only use
+ * integer math (see fx_init()), so a battle has the same result with
+ * every compiler, optimization level and CPU.
+ **/
+
+/**
+ * Protector rotation at the current tick. Counts from the launch time
+ * and the tick instead of summing up battleTime.
+ **/
+fixed_t fx_protector_offset()
+{
+	if(gameOptions.rotatingProtectors == false) {
+		return 0;
+	}
+	return battleStartMs * FX(PROTECTOR_ROTSPEED) / 1000 + battleTicks * FX(PROTECTOR_ROTSPEED) / SIM_RATE;
+}
+
+static inline fixed2 fx_field_force(fixed2 pos, fixed2 center, fixed_t weight)
+{
+	fixed2 dst = {
+		pos.x - center.x,
+		pos.y - center.y,
+	};
+	// the minimum keeps the strength in range
+	fixed_t len = MAX(fx_length(dst), FX_ONE);
+	
+	// (2000 / len)^2 / len
+	fixed_t strength = ((fixed_t)2000 << (2 * FX_SHIFT)) / len;
+	strength = FX_MUL(strength, strength);
+	strength = (strength << FX_SHIFT) / len;
+	
+	return (fixed2){ weight * FX_MUL(dst.x, strength), weight * FX_MUL(dst.y, strength) };
+}
+
+static fixed2 fx_field_tree_acceleration(affector_pack_t const *pack, fixed2 pos)
+{
+	fixed2 accel = { 0, 0 };
+	int stack[4 * FIELD_TREE_DEPTH];
+	int top = 0;
+	if(pack->nodeCount > 0) {
+		stack[top++] = 0;
+	}
+	while(top > 0)
+	{
+		field_node_t const *node = &pack->nodes[stack[--top]];
+		fixed2 mid = { node->min.x + node->size / 2, node->min.y + node->size / 2 };
+		if(node->size * 1000 < gameOptions.fieldTheta * (fx_distance(pos, mid) - node->size * 7072 / 10000)) {
+			for(int s = 0; s < 2; s++) {
+				if(node->mass[s] > 0) {
+					fixed2 f = fx_field_force(pos, node->fxCenter[s], (s ? 1 : -1) * node->mass[s]);
+					accel.x += f.x;
+					accel.y += f.y;
 				}
 			}
-			
-			if(e.type == SDL_MOUSEMOTION);
-			{
-				if(currentAffector != NULL && isRotating)
-				{
-					float2 delta = {
-						e.motion.x - currentAffector->center.x - battleground.x,
-						e.motion.y - currentAffector->center.y,
-					};
-					
-					currentAffector->rotation = 90 - RAD_TO_DEG(atan2(delta.x, delta.y));
+		} else if(node->leaf) {
+			for(int i = node->first; i < node->first + node->count; i++) {
+				int f = pack->order[i];
+				fixed2 force = fx_field_force(pos, (fixed2){ pack->fxFieldX[f], pack->fxFieldY[f] }, pack->fxFieldSign[f]);
+				accel.x += force.x;
+				accel.y += force.y;
+			}
+		} else {
+			for(int q = 0; q < 4; q++) {
+				if(node->children[q] >= 0) {
+					stack[top++] = node->children[q];
 				}
-				if(currentAffector != NULL && isMoving)
-				{
-					if(isMoving == 1) {
-						isMoving = 2;
-					} else {
-						currentAffector->center.x += e.motion.xrel;
-						currentAffector->center.y += e.motion.yrel;
-					}
+			}
+		}
+	}
+	return accel;
+}
+
+fixed2 fx_field_acceleration(fixed2 pos)
+{
+	affector_pack_t const *pack = affector_pack();
+	if(gameOptions.fieldTheta > 0) {
+		return fx_field_tree_acceleration(pack, pos);
+	}
+	fixed2 accel = { 0, 0 };
+	for(int i = 0; i < pack->fieldCount; i++)
+	{
+		fixed2 f = fx_field_force(pos, (fixed2){ pack->fxFieldX[i], pack->fxFieldY[i] }, pack->fxFieldSign[i]);
+		accel.x += f.x;
+		accel.y += f.y;
+	}
+	return accel;
+}
+
+affector_t *fx_affector_contact(fixed2 from, fixed2 to)
+{
+	fixed2 seg = {
+		to.x - from.x,
+		to.y - from.y,
+	};
+	fixed_t segLen2 = seg.x*seg.x + seg.y*seg.y; // Q32
+	
+	affector_pack_t const *pack = affector_pack();
+	int hit = -1;
+	fixed_t hitT = 2 * FX_ONE;
+	for(int i = 0; i < pack->count; i++)
+	{
+		fixed2 center = { pack->fxX[i], pack->fxY[i] };
+		fixed_t t = 0;
+		if(segLen2 > 0) {
+			fixed_t num = (center.x - from.x) * seg.x + (center.y - from.y) * seg.y;
+			fixed_t den = segLen2;
+			if(num >= den) {
+				t = FX_ONE;
+			} else if(num > 0) {
+				while(den >= ((fixed_t)1 << 46)) {
+					num >>= 1;
+					den >>= 1;
 				}
+				t = (num << FX_SHIFT) / den;
 			}
 		}
+		fixed2 dst = {
+			from.x + FX_MUL(t, seg.x) - center.x,
+			from.y + FX_MUL(t, seg.y) - center.y,
+		};
+		bool closer = (dst.x*dst.x + dst.y*dst.y) <= FX(AFFECTOR_RADIUS) * FX(AFFECTOR_RADIUS) && t < hitT;
+		hit = closer ? i : hit;
+		hitT = closer ? t : hitT;
+	}
+	return (hit >= 0) ? &affectors[hit] : NULL;
+}
+
+static fixed_t fx_distance2(fixed2 a, fixed2 b)
+{
+	return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y); // Q32
+}
+
+/**
+ * Same as segment_near_ring(), but on squared distances. |dx| + |dy|
+ * is never shorter than the segment, so the test stays conservative.
+ **/
+static bool fx_segment_near_ring(fixed2 from, fixed2 to, fixed2 center)
+{
+	fixed_t len = llabs(to.x - from.x) + llabs(to.y - from.y);
+	fixed_t d0 = fx_distance2(from, center);
+	fixed_t d1 = fx_distance2(to, center);
+	fixed_t nearest = (d0 < d1) ? d0 : d1;
+	fixed_t farthest = (d0 < d1) ? d1 : d0;
+	fixed_t outer = FX(PROTECTOR_RING_OUTER) + len;
+	return nearest <= outer * outer && farthest >= FX(PROTECTOR_RING_INNER) * FX(PROTECTOR_RING_INNER);
+}
+
+bool fx_obstacle_collision(fixed2 from, fixed2 to)
+{
+	for(block_t *b = blockchain; b != NULL; b = b->next)
+	{
+		SDL_Rect rect = b->rect;
 		
-		SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
-		SDL_RenderClear(renderer);
+		if(MAX(from.x, to.x) < FX(rect.x - 1) || MIN(from.x, to.x) > FX(rect.x + rect.w + 1) ||
+		   MAX(from.y, to.y) < FX(rect.y - 1) || MIN(from.y, to.y) > FX(rect.y + rect.h + 1)) {
+			continue;
+		}
 		
-		render_battleground();
+		bool hit = fx_check_collision(
+				from,
+				to,
+				(fixed2){ FX(rect.x), FX(rect.y) },
+				(fixed2){ FX(rect.w), FX(rect.h) },
+				0);
+		
+		if(hit) {
+			battleWallHits += 1;
+			sim_sound(SND_IMPACT_WALL);
+			return true;
+		}
+	}
+	
+	bool nearLeft = fx_segment_near_ring(from, to, (fixed2){ 0, FX(battleground.h / 2) });
+	bool nearRight = fx_segment_near_ring(from, to, (fixed2){ FX(battleground.w), FX(battleground.h / 2) });
+	if(nearLeft == false && nearRight == false) {
+		return false;
+	}
+	
+	fixed_t offset = fx_protector_offset();
+	fixed2 size = { FX(12), FX(30) };
+	for(int i = 0; i < 24; i++) {
+		int baseRadius = 136;
 		
-		{ // Draw closed tool panels
-			SDL_Rect leftPanel = {
-				0, 0, 128, 720
+		if(nearLeft && leftBase.protectors[i] > 0) {
+			fixed_t angle = 15 * i * FX_ONE - offset;
+			fixed2 target = {
+				baseRadius * fx_sin(angle) - FX(6),
+				FX(battleground.h / 2) + baseRadius * fx_cos(angle) - FX(15),
 			};
-			if(player == &leftBase) {
-				
-				SDL_RenderCopy(
-					renderer,
-					texBackPanel,
-					NULL,
-					&leftPanel);
+			if(fx_check_collision(from, to, target, size, -angle - 90 * FX_ONE)) {
+				leftBase.protectors[i] -= 1;
+				battle_hash_event(BATTLE_HASH_PROTECTOR + i, leftBase.protectors[i]);
+				sim_sound(SND_IMPACT_BARRICADE);
+				return true;
+			}
+		}
+		
+		if(nearRight && rightBase.protectors[i] > 0) {
+			fixed_t angle = 15 * i * FX_ONE + offset;
+			fixed2 target = {
+				FX(battleground.w) - baseRadius * fx_sin(angle) - FX(6),
+				FX(battleground.h / 2) + baseRadius * fx_cos(angle) - FX(15),
+			};
+			if(fx_check_collision(from, to, target, size, angle - 90 * FX_ONE)) {
+				rightBase.protectors[i] -= 1;
+				battle_hash_event(BATTLE_HASH_PROTECTOR + 24 + i, rightBase.protectors[i]);
+				sim_sound(SND_IMPACT_BARRICADE);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * Advances a projectile by dt (Q24 seconds), returns the position
+ * where the projectile stopped.
+ **/
+static fixed2 fx_integrate_projectile(projectile_t *p, fixed_t dt)
+{
+	fixed2 end = p->fxPos;
+	
+	fixed_t remaining = dt;
+	while(remaining > 0 && p->active)
+	{
+		fixed_t speed = fx_length(p->fxVel);
+		if(speed < FX(SIM_MIN_SPEED)) {
+			speed = FX(SIM_MIN_SPEED);
+		}
+		fixed_t accel = fx_length(p->fxAcc);
+		fixed_t maxTurn = FX_MUL(FX(SIM_MAX_TURN), speed);
+		
+		fixed_t h = remaining;
+		if(((speed * h) >> FX_TIME_SHIFT) > FX(SIM_MAX_STEP)) {
+			h = (FX(SIM_MAX_STEP) << FX_TIME_SHIFT) / speed;
+		}
+		if(((accel * h) >> FX_TIME_SHIFT) > maxTurn) {
+			h = (maxTurn << FX_TIME_SHIFT) / accel;
+		}
+		if(h < dt / SIM_MAX_SUBSTEPS) {
+			h = dt / SIM_MAX_SUBSTEPS;
+		}
+		if(h > remaining) {
+			h = remaining;
+		}
+		
+		fixed2 newPos = {
+			p->fxPos.x + (((p->fxVel.x + ((h * p->fxAcc.x) >> (FX_TIME_SHIFT + 1))) * h) >> FX_TIME_SHIFT),
+			p->fxPos.y + (((p->fxVel.y + ((h * p->fxAcc.y) >> (FX_TIME_SHIFT + 1))) * h) >> FX_TIME_SHIFT),
+		};
+		end = newPos;
+		
+		affector_t *a = fx_affector_contact(p->fxPos, newPos);
+		if(a != NULL) {
+			affector_crash(p, a);
+			p->active = false;
+			break;
+		}
+		
+		if(fx_obstacle_collision(p->fxPos, newPos)) {
+			p->active = false;
+			break;
+		}
+		
+		fixed2 newAcc = fx_field_acceleration(newPos);
+		p->fxVel.x += ((p->fxAcc.x + newAcc.x) * h) >> (FX_TIME_SHIFT + 1);
+		p->fxVel.y += ((p->fxAcc.y + newAcc.y) * h) >> (FX_TIME_SHIFT + 1);
+		p->fxAcc = newAcc;
+		p->fxPos = newPos;
+		
+		remaining -= h;
+	}
+	
+	// the renderer only knows floats
+	p->pos = fx_to_float2(p->fxPos);
+	p->vel = fx_to_float2(p->fxVel);
+	return end;
+}
+
+/**
+ * Advances a projectile by dt seconds.
+ **/
+void integrate_projectile(projectile_t *p, float dt)
+{
+	float2 end = p->pos;
+	
+	p->prevPos = p->pos;
+	
+	if(gameOptions.fixedPoint) {
+		end = fx_to_float2(fx_integrate_projectile(p, FX_TIME(dt)));
+	} else {
+		float remaining = dt;
+		while(remaining > 0 && p->active)
+		{
+			float speed = MAX(length(p->vel), SIM_MIN_SPEED);
+			float accel = length(p->acc);
+		
+			float h = remaining;
+			if(speed * h > SIM_MAX_STEP) {
+				h = SIM_MAX_STEP / speed;
+			}
+			if(accel * h > SIM_MAX_TURN * speed) {
+				h = SIM_MAX_TURN * speed / accel;
+			}
+			h = MAX(h, dt / SIM_MAX_SUBSTEPS);
+			h = MIN(h, remaining);
+		
+			float2 newPos = {
+				p->pos.x + h * (p->vel.x + 0.5 * h * p->acc.x),
+				p->pos.y + h * (p->vel.y + 0.5 * h * p->acc.y),
+			};
+			end = newPos;
+		
+			affector_t *a = affector_contact(p->pos, newPos);
+			if(a != NULL) {
+				// we crashen in an affector
+				affector_crash(p, a);
+				p->active = false;
+				break;
+			}
+		
+			if(obstacle_collision(p->pos, newPos)) {
+				p->active = false;
+				break;
+			}
+		
+			float2 newAcc = field_acceleration(newPos);
+			p->vel.x += 0.5 * h * (p->acc.x + newAcc.x);
+			p->vel.y += 0.5 * h * (p->acc.y + newAcc.y);
+			p->acc = newAcc;
+			p->pos = newPos;
+		
+			remaining -= h;
+		}
+	}
+	
+	// the trail goes up to the impact, even if we aren't active any more
+	if(simulateEffects) {
+		trail_push(p, end);
+	}
+}
+
+#define BATTLE_RUNNING        0
+#define BATTLE_FINISHED       1
+#define BATTLE_LEFT_DESTROYED 2
+#define BATTLE_RIGHT_DESTROYED 3
+
+/**
+ * A turn never takes longer than this many ticks. Projectiles that
+ * are still alive (e.g. orbiting an affector) fizzle out after that.
+ **/
+#define BATTLE_MAX_TICKS (60 * 120)
+
+/**
+ * Advances the battle by one tick of dt seconds.
+ * Returns BATTLE_RUNNING as long as any projectile is alive.
+ **/
+int battle_tick(float dt)
+{
+	uint32_t hash = 0;
+	
+	// tick all projectiles
+	for(projectile_t *p = projectiles; p != NULL; p = p->next)
+	{
+		if(p->active == false) {
+			continue;
+		}
+		bool outside, hitsLeft, hitsRight;
+		if(gameOptions.fixedPoint) {
+			fixed2 pos = p->fxPos;
+			outside =
+				pos.x < FX(-10) || pos.y < FX(-10) ||
+				pos.x >= FX(battleground.w + 10) || pos.y >= FX(battleground.h + 10);
+			hitsLeft = fx_distance2(pos, (fixed2){ 0, FX(battleground.h / 2) }) <= FX(126) * FX(126);
+			hitsRight = fx_distance2(pos, (fixed2){ FX(battleground.w), FX(battleground.h / 2) }) <= FX(126) * FX(126);
+		} else {
+			float2 leftBasePos = { 0, battleground.h / 2 };
+			float2 rightBasePos = { battleground.w, battleground.h / 2 };
+			
+			outside =
+				p->pos.x < -10 || p->pos.y < -10 ||
+				p->pos.x >= (battleground.w + 10) || p->pos.y >= (battleground.h + 10);
+			hitsLeft = distance(p->pos, leftBasePos) <= 126;
+			hitsRight = distance(p->pos, rightBasePos) <= 126;
+		}
+		
+		// disable all out-of-screen projectiles
+		if(outside) {
+			p->active = false;
+		}
+		if(battleTicks >= BATTLE_MAX_TICKS) {
+			p->active = false;
+		}
+		
+		if(p->active && hitsLeft) {
+			sim_sound(SND_IMPACT_BASE);
+			// hit left base
+			leftBase.lifepoints--;
+			battle_hash_event(BATTLE_HASH_BASE, leftBase.lifepoints);
+			if(leftBase.lifepoints < 0) {
+				return BATTLE_LEFT_DESTROYED;
+			}
+			p->active = false;
+		}
+		if(p->active && hitsRight) {
+			sim_sound(SND_IMPACT_BASE);
+			// hit right base
+			rightBase.lifepoints--;
+			battle_hash_event(BATTLE_HASH_BASE + 1, rightBase.lifepoints);
+			if(rightBase.lifepoints < 0) {
+				return BATTLE_RIGHT_DESTROYED;
+			}
+			p->active = false;
+		}
+		
+		if(p->active == false) {
+			continue;
+		}
+		
+		integrate_projectile(p, dt);
+		hash += projectile_hash(p);
+	}
+	battle_hash(hash);
+	
+	battleTicks += 1;
+	battleTime += dt;
+	
+	for(projectile_t *p = projectiles; p != NULL; p = p->next)
+	{
+		if(p->active) {
+			return BATTLE_RUNNING;
+		}
+	}
+	return BATTLE_FINISHED;
+}
+
+void battle_simulation()
+{
+	SDL_Event e;
+	uint64_t lastFrame = SDL_GetPerformanceCounter();
+	float accumulator = 0.0;
+	gameStats.phase = STATS_PHASE_SIMULATE;
+	
+	while(true)
+	{
+		bool instant = false;
+		
+		while(SDL_PollEvent(&e))
+		{
+			latency_event(&e);
+			if(e.type == SDL_QUIT) exit(1);
+			if(e.type == SDL_KEYDOWN) {
+				switch(e.key.keysym.sym)
+				{
+					case SDLK_ESCAPE:
+						isGameRunning = false;
+						return;
+					case SDLK_1: battleSpeed = 1; break;
+					case SDLK_2: battleSpeed = 2; break;
+					case SDLK_3: battleSpeed = 4; break;
+					case SDLK_4: battleSpeed = 8; break;
+					case SDLK_TAB:
+						battleSpeed = (battleSpeed >= 8) ? 1 : (2 * battleSpeed);
+						break;
+					case SDLK_RETURN:
+						instant = true;
+						break;
+				}
+			}
+		}
+		
+		accumulator += frame_time(&lastFrame) * battleSpeed;
+		
+		int state = BATTLE_RUNNING;
+		int ticks = 0;
+		uint64_t tickTime = 0;
+		if(instant) {
+			// Resolve the whole turn without rendering anything
+			simulateEffects = false;
+			uint64_t start = SDL_GetPerformanceCounter();
+			while(state == BATTLE_RUNNING) {
+				state = battle_tick(SIM_DT);
+				replay_tick();
+				ticks++;
+			}
+			tickTime = SDL_GetPerformanceCounter() - start;
+			simulateEffects = true;
+			spectate_keyframe(true);
+		} else {
+			while(accumulator >= SIM_DT && state == BATTLE_RUNNING) {
+				uint64_t start = SDL_GetPerformanceCounter();
+				state = battle_tick(SIM_DT);
+				tickTime += SDL_GetPerformanceCounter() - start;
+				replay_tick();
+				ticks++;
+				spectate_tick();
+				accumulator -= SIM_DT;
+			}
+		}
+		spectate_flush();
+		if(ticks > 0) {
+			gameStats.ticks += ticks;
+			gameStats.tickMs = tickTime * 1000.0 / SDL_GetPerformanceFrequency() / ticks;
+		}
+		if(state != BATTLE_RUNNING) {
+			LOG_INFO("Turn %u: %d ticks, battle hash %08X", gameStats.turn, battleTicks, battleHash);
+			replay_battle();
+		}
+		
+		switch(state) {
+			case BATTLE_FINISHED:
+				return;
+			case BATTLE_LEFT_DESTROYED:
+				gameStats.matches += 1;
+				gameStats.wins[1] += 1;
+				endscreen(texFinalGreen);
+				return;
+			case BATTLE_RIGHT_DESTROYED:
+				gameStats.matches += 1;
+				gameStats.wins[0] += 1;
+				endscreen(texFinalBlue);
+				return;
+		}
+		
+		SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+		SDL_RenderClear(renderer);
+		
+		renderAlpha = accumulator / SIM_DT;
+		render_battleground();
+		renderAlpha = 1.0;
+		
+		render_tool_panels(NULL);
+		latency_render();
+		
+		audio_flush();
+		
+		// Paced by vsync, the simulation rate doesn't depend on it.
+		frame_present();
+	}
+
+}
+
+void battle_reset()
+{
+	// projectiles only live for a turn
+	arena_reset(&turnArena);
+	projectiles = NULL;
+	battleTicks = 0;
+	battleProjectiles = 0;
+	battleWallHits = 0;
+	battleHash = 0;
+	
+	// destroyed affectors are already gone
+	if(gameOptions.affectorsStay == false) {
+		affectors_clear();
+	}
+}
+
+/**
+ * Undo and redo in the build phase (Ctrl+Z, Ctrl+Y or Ctrl+Shift+Z).
+ * Every placement, move, rotation and removal is stored as the state of
+ * the one affector it changed, before and after, in a ring of the last
+ * BUILD_HISTORY_SIZE edits which is cleared every turn. Undoing an edit
+ * only touches that affector and its resource, no matter how many
+ * affectors stay on the board. When undo or redo creates an affector
+ * again, it gets a new handle which replaces the old one in the ring.
+ **/
+#define BUILD_HISTORY_SIZE 64
+
+typedef struct {
+	bool present;
+	int type;
+	float2 center;
+	float rotation;
+	int lifepoints;
+} build_state_t;
+
+typedef struct {
+	affector_handle_t handle;
+	build_state_t before;
+	build_state_t after;
+} build_edit_t;
+
+struct {
+	build_edit_t edits[BUILD_HISTORY_SIZE];
+	int first; // the oldest edit
+	int count;
+	int done;  // edits that are applied, the ones after them can be redone
+} buildHistory;
+
+void build_history_clear()
+{
+	buildHistory.first = 0;
+	buildHistory.count = 0;
+	buildHistory.done = 0;
+}
+
+static build_state_t build_state(affector_t const *a)
+{
+	if(a == NULL) {
+		return (build_state_t){ false };
+	}
+	return (build_state_t){ true, a->type, a->center, a->rotation, a->lifepoints };
+}
+
+static build_edit_t *build_edit(int i)
+{
+	return &buildHistory.edits[(buildHistory.first + i) % BUILD_HISTORY_SIZE];
+}
+
+/**
+ * Records an edit of the affector, unless nothing changed. Drops the
+ * edits that could be redone.
+ **/
+static void build_record(affector_handle_t handle, build_state_t before, build_state_t after)
+{
+	if(before.present == after.present && (before.present == false || (
+	   before.center.x == after.center.x && before.center.y == after.center.y &&
+	   before.rotation == after.rotation))) {
+		return;
+	}
+	buildHistory.count = buildHistory.done;
+	if(buildHistory.count == BUILD_HISTORY_SIZE) {
+		buildHistory.first = (buildHistory.first + 1) % BUILD_HISTORY_SIZE;
+		buildHistory.count -= 1;
+	}
+	*build_edit(buildHistory.count) = (build_edit_t){ handle, before, after };
+	buildHistory.count += 1;
+	buildHistory.done = buildHistory.count;
+}
+
+/**
+ * Brings an affector into a recorded state. Returns its handle, or
+ * AFFECTOR_NONE if it can't be created again.
+ **/
+static affector_handle_t build_apply(base_t *player, affector_handle_t handle, build_state_t const *state)
+{
+	affector_t *a = affector_get(handle);
+	if(state->present == false) {
+		if(a != NULL) {
+			player->resources[a->type] += 1;
+			affector_remove(a);
+		}
+		return handle;
+	}
+	if(a == NULL) {
+		if(player->resources[state->type] <= 0 || (a = create_affector(player, state->type, state->center)) == NULL) {
+			return AFFECTOR_NONE;
+		}
+		player->resources[state->type] -= 1;
+		
+		affector_handle_t created = affector_handle(a);
+		for(int i = 0; i < buildHistory.count; i++) {
+			if(build_edit(i)->handle == handle) {
+				build_edit(i)->handle = created;
+			}
+		}
+		handle = created;
+	}
+	a->center = state->center;
+	a->rotation = state->rotation;
+	a->lifepoints = state->lifepoints;
+	return handle;
+}
+
+/**
+ * Undoes the last edit, returns the affector to select.
+ **/
+affector_handle_t build_undo(base_t *player)
+{
+	if(buildHistory.done == 0) {
+		return AFFECTOR_NONE;
+	}
+	build_edit_t *edit = build_edit(buildHistory.done - 1);
+	affector_handle_t handle = build_apply(player, edit->handle, &edit->before);
+	if(edit->before.present && handle == AFFECTOR_NONE) {
+		return AFFECTOR_NONE;
+	}
+	buildHistory.done -= 1;
+	return edit->before.present ? handle : AFFECTOR_NONE;
+}
+
+/**
+ * Redoes the last undone edit, returns the affector to select.
+ **/
+affector_handle_t build_redo(base_t *player)
+{
+	if(buildHistory.done == buildHistory.count) {
+		return AFFECTOR_NONE;
+	}
+	build_edit_t *edit = build_edit(buildHistory.done);
+	affector_handle_t handle = build_apply(player, edit->handle, &edit->after);
+	if(edit->after.present && handle == AFFECTOR_NONE) {
+		return AFFECTOR_NONE;
+	}
+	buildHistory.done += 1;
+	return edit->after.present ? handle : AFFECTOR_NONE;
+}
+
+void player_build(base_t *player)
+{
+	int draggingAffector = -1;
+	
+	SDL_Event e;
+	
+	// the affector being edited, as a handle so it can't dangle
+	affector_handle_t selection = AFFECTOR_NONE;
+	affector_handle_t edited = AFFECTOR_NONE; // the selection when the mouse button went down
+	build_state_t editedBefore = { false };
+	
+	bool isRotating = true;
+	int isMoving = 0;
+	
+	uint64_t lastFrame = SDL_GetPerformanceCounter();
+	gameStats.phase = STATS_PHASE_BUILD;
+	
+	while(true)
+	{
+		frame_wait();
+		
+		while(SDL_PollEvent(&e))
+		{
+			affector_t *currentAffector = affector_get(selection);
+			
+			latency_event(&e);
+			if(e.type == SDL_KEYDOWN || e.type == SDL_MOUSEBUTTONDOWN || e.type == SDL_MOUSEBUTTONUP || e.type == SDL_MOUSEMOTION) {
+				latency_input(LATENCY_BUILD, &e);
+			}
+			if(e.type == SDL_QUIT) exit(0);
+			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) {
+				isGameRunning = false;
+				return;
+			}
+			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_SPACE) return;
+			
+			if(e.type == SDL_KEYDOWN && (e.key.keysym.mod & KMOD_CTRL) && draggingAffector < 0 && isMoving == 0)
+			{
+				bool shift = (e.key.keysym.mod & KMOD_SHIFT) != 0;
+				if(e.key.keysym.sym == SDLK_z && shift == false) {
+					selection = build_undo(player);
+					isRotating = false;
+				}
+				if(e.key.keysym.sym == SDLK_y || (e.key.keysym.sym == SDLK_z && shift)) {
+					selection = build_redo(player);
+					isRotating = false;
+				}
+			}
+			
+			if(e.type == SDL_MOUSEBUTTONDOWN)
+			{
 				SDL_Rect target = {
 					32, 32, 64, 64
 				};
+				if(player == &rightBase) {
+					target.x += battleground.x;
+					target.x += battleground.w;
+				}
+				draggingAffector = -1;
 				for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
 					int count = player->resources[i];
 					if(count <= 0) {
 						continue;
 					}
-				
-					SDL_RenderCopy(
-						renderer,
-						texAffector[i],
-						NULL,
-						&target);
 					
-					SDL_Rect number = {
-						target.x + 48, target.y + 48,
-						16, 16
-					};
-					SDL_Rect numberSrc = {
-						16 * count, 0,
-						16, 16
-					};
-					SDL_RenderCopy(
-						renderer,
-						texNumbers,
-						&numberSrc,
-						&number);
+					if(e.button.x >= target.x && e.button.y >= target.y &&
+					   e.button.x < (target.x + target.w) &&
+						 e.button.y < (target.y + target.h))
+					{
+						draggingAffector = i;
+						break;
+					}
 				
 					target.y += 96;
 				}
-			
-			} else {
-				SDL_RenderCopy(
-					renderer,
-					texLeftPanel,
-					NULL,
-					&leftPanel);
+				
+				if(draggingAffector < 0)
+				{
+					// Check for dragging the move point
+					if(currentAffector != NULL)
+					{							
+						float2 pos = {
+							48 * cosf(DEG_TO_RAD(-currentAffector->rotation)),
+							-48 * sinf(DEG_TO_RAD(-currentAffector->rotation)),
+						};
+						pos.x += currentAffector->center.x;
+						pos.y += currentAffector->center.y;
+						
+						SDL_Rect grabbag = {
+							battleground.x + pos.x - 6, pos.y - 6,
+							12, 12
+						};
+						
+						if(e.button.x >= grabbag.x && e.button.y >= grabbag.y &&
+					   e.button.x < (grabbag.x + grabbag.w) &&
+						 e.button.y < (grabbag.y + grabbag.h))
+						{
+							isRotating = true;
+						}
+						
+						float2 delta = {
+							e.button.x - currentAffector->center.x - battleground.x,
+							e.button.y - currentAffector->center.y,
+						};
+						if(length(delta) < 16) {
+							isMoving = 1;
+							SDL_SetRelativeMouseMode(SDL_TRUE);
+						}
+						
+						if(length(delta) > 64) {
+							isMoving = 0;
+							isRotating = false;
+							SDL_SetRelativeMouseMode(SDL_FALSE);
+							currentAffector = NULL;
+							selection = AFFECTOR_NONE;
+						}
+					}
+					// No else-if: Allows reselection of other affectors.
+					if(currentAffector == NULL)
+					{
+						float minDist = 16;
+						for(int i = 0; i < affectorCount; i++)
+						{
+							affector_t *p = &affectors[i];
+							if(p->owner != player) {
+								continue;
+							}
+							float2 pos = {
+								battleground.x + p->center.x,
+								p->center.y,
+							};
+							pos.x -= e.button.x;
+							pos.y -= e.button.y;
+							float l = length(pos);
+							if(l > minDist) {
+								continue;
+							}
+							l = minDist;
+							currentAffector = p;
+							selection = affector_handle(p);
+						}
+					}
+				}
+				edited = selection;
+				editedBefore = build_state(currentAffector);
+			}
+			
+			if(e.type == SDL_MOUSEBUTTONUP)
+			{
+				if(draggingAffector >= 0) {
+					LOG_DEBUG("Drop affector %d at %d,%d", draggingAffector, e.button.x, e.button.y);
+					if(e.button.x >= battleground.x && e.button.x < (battleground.x + battleground.w)) {
+						affector_t *a = create_affector(player, draggingAffector, (float2){e.button.x - 128, e.button.y});
+						if(a != NULL) {
+							if(player == &rightBase) {
+								a->rotation = 180;
+							}
+							currentAffector = a;
+							selection = affector_handle(a);
+							player->resources[draggingAffector] -= 1;
+							build_record(selection, (build_state_t){ false }, build_state(a));
+						}
+					}
+					draggingAffector = -1;
+				}
+				
+				if(currentAffector != NULL && selection == edited && (isRotating || isMoving)) {
+					bool removed = isMoving && (e.button.x <= battleground.x || e.button.x > (battleground.x + battleground.w));
+					build_record(selection, editedBefore, removed ? (build_state_t){ false } : build_state(currentAffector));
+				}
+				if(isRotating) {
+					isRotating = false;
+				}
+				if(isMoving) {
+					if(currentAffector != NULL && (e.button.x <= battleground.x || e.button.x > (battleground.x + battleground.w))) {
+						player->resources[currentAffector->type] += 1; // return affector to inventory
+						affector_remove(currentAffector);
+						currentAffector = NULL;
+						selection = AFFECTOR_NONE;
+					}
+					isMoving = 0;
+					SDL_SetRelativeMouseMode(SDL_FALSE);
+				}
+				
+				SDL_Rect button = {
+					16, 668,
+					96, 36
+				};
+				if(player == &rightBase) {
+					button.x += battleground.x + battleground.w;
+				}
+				if(e.button.x >= button.x && e.button.x < (button.x + button.w) &&
+					 e.button.y >= button.y && e.button.y < (button.y + button.h)) 
+				{
+					// On click: finish!
+					return;
+				}
+				
+				{ // Check for click on base:
+					float x = e.button.x - battleground.x;
+					if(player == &rightBase) {
+						x -= battleground.w;
+					}
+					float y = e.button.y - battleground.h/2;
+					
+					if((x*x+y*y) < (125*125))
+					{
+						if(player == &rightBase) {
+							if(x < 0) {
+								// Launch when click on base.
+								return;
+							}
+						}
+						if(player == &leftBase) {
+							if(x > 0) {
+								// Launch
+								return;
+							}
+						}
+					}
+				}
+			}
+			
+			if(e.type == SDL_MOUSEMOTION);
+			{
+				if(currentAffector != NULL && isRotating)
+				{
+					float2 delta = {
+						e.motion.x - currentAffector->center.x - battleground.x,
+						e.motion.y - currentAffector->center.y,
+					};
+					
+					currentAffector->rotation = 90 - RAD_TO_DEG(atan2(delta.x, delta.y));
+				}
+				if(currentAffector != NULL && isMoving)
+				{
+					if(isMoving == 1) {
+						isMoving = 2;
+					} else {
+						// stays on the battleground, turn_legal() rejects anything else
+						currentAffector->center.x = MIN(MAX(currentAffector->center.x + e.motion.xrel, 0), battleground.w);
+						currentAffector->center.y = MIN(MAX(currentAffector->center.y + e.motion.yrel, 0), battleground.h);
+					}
+				}
+			}
+		}
+		
+		SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
+		SDL_RenderClear(renderer);
+		
+		render_battleground();
+		battleTime += frame_time(&lastFrame);
+		
+		render_tool_panels(player);
+		
+		{ // Launch Button
+			int x,y;
+			int buttons = SDL_GetMouseState(&x, &y);
+			
+			SDL_Rect button = {
+				16, 668,
+				96, 36
+			};
+			if(player == &rightBase) {
+				button.x += battleground.x + battleground.w;
+			}
+			SDL_Texture *tex = texButtonLaunch[BUTTON_NORMAL];
+			
+			if(x >= button.x && x < (button.x + button.w) &&
+			   y >= button.y && y < (button.y + button.h)) 
+			{
+				if(buttons & SDL_BUTTON(SDL_BUTTON_LEFT)) {
+					tex = texButtonLaunch[BUTTON_PRESSED];
+				} else {
+					tex = texButtonLaunch[BUTTON_HOVER];
+				}
+			}
+			
+			SDL_RenderCopy(
+				renderer,
+				tex,
+				NULL,
+				&button);
+		}
+		
+		if(draggingAffector >= 0)
+		{
+			SDL_Rect target = {
+				0, 0,
+				64, 64
+			};
+			
+			SDL_GetMouseState(&target.x, &target.y);
+			target.x -= 32;
+			target.y -= 32;
+				
+			SDL_RenderCopyEx(
+				renderer,
+				texAffector[draggingAffector],
+				NULL,
+				&target,
+				(player == &rightBase) ? 180 : 0,
+				NULL,
+				SDL_FLIP_NONE);
+		}
+		
+		render_selection(affector_get(selection), isRotating);
+		latency_render();
+		
+		spectate_flush();
+		
+		frame_present();
+	}
+}
+
+/**
+ * Plays a turn for --bot: places every available affector at a
+ * random spot and picks a random launch angle, both from botRng.
+ **/
+void bot_build(base_t *player, float *angle)
+{
+	for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
+		if(player->resources[i] <= 0) {
+			continue;
+		}
+		float2 pos = {
+			200 + rng_range(&botRng, 300),
+			100 + rng_range(&botRng, 520),
+		};
+		if(player == &rightBase) {
+			pos.x = battleground.w - pos.x;
+		}
+		affector_t *a = create_affector(player, i, pos);
+		if(a == NULL) {
+			break;
+		}
+		a->rotation = rng_range(&botRng, 360);
+		player->resources[i] -= 1;
+	}
+	*angle = 15.0 + rng_range(&botRng, 151);
+}
+
+/**
+ * Puts both bases into their initial state and removes all affectors.
+ **/
+void match_init()
+{
+	arena_reset(&matchArena);
+	affectors_init();
+	
+	rng_seed(&gameplayRng, matchSeed, RNG_STREAM_GAMEPLAY);
+	rng_seed(&cosmeticRng, matchSeed, RNG_STREAM_COSMETIC);
+	rng_seed(&botRng, matchSeed, RNG_STREAM_BOT);
+	
+	leftBase = (base_t) {
+		{ 92, 75, 255, 255 },
+		{ 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3 },
+		{ 0, 0, 0, 0, 0 },
+		AFFECTOR_COOLDOWNS,
+		BASE_LIFEPOINTS
+	};
+
+	rightBase = (base_t) {
+		{ 85, 182, 74, 255 },
+		{ 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3 },
+		{ 0, 0, 0, 0, 0 },
+		AFFECTOR_COOLDOWNS,
+		BASE_LIFEPOINTS
+	};
+	
+	for(int i = 0; i < 24; i++) {
+		leftBase.protectors[i] = PROTECTOR_LIFE;
+		rightBase.protectors[i] = PROTECTOR_LIFE;
+	}
+	
+	battleTime = 0.0;
+}
+
+/**
+ * Clears the last battle and resupplies the player on turn.
+ **/
+void turn_begin(base_t *player)
+{
+	battle_reset();
+	
+	for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) 
+	{
+		player->respawn[i] -= 1;
+		if(player->respawn[i] <= 0) {
+			player->resources[i] += 1;
+			player->respawn[i] = cooldowns[i];
+		}
+	}
+}
+
+void start_round(const char *level)
+{
+	// Load level
+	load_level(level);
+
+	// Initialize game state	
+	if(netMode == NET_NONE) {
+		matchSeed = rng_new_seed();
+	}
+	match_init();
+	if(replayFile != NULL) {
+		replay_begin(replayFile, currentLevel);
+	}
+	
+	// Start game
+	base_t *player = &leftBase;
+	isGameRunning = true;
+	for(int turn = 0; true; turn++)
+	{
+		LOG_DEBUG("Turn %d: reset battle and resupply", turn);
+		gameStats.turn = turn;
+		turn_begin(player);
+		build_history_clear();
+		
+		float angle = 15.0;
+		if(netMode != NET_NONE)
+		{
+			turn_t t;
+			uint32_t hash = state_hash();
+			if(player == netLocalPlayer) {
+				if(netBot) {
+					bot_build(player, &angle);
+				} else {
+					do {
+						LOG_DEBUG("Battle setup");
+						player_build(player);
+						if(isGameRunning == false) return;
+					
+						LOG_DEBUG("Start aiming");
+					} while(player_aim(player, &angle) == false);
+				}
+				capture_turn(player, angle, &t);
+				t.hash = hash;
+				if(net_send_turn(&t) == false) {
+					isGameRunning = false;
+					return;
+				}
+			} else {
+				LOG_INFO("Waiting for remote turn %d", turn);
+				if(net_receive_turn(player, &t) == false) {
+					isGameRunning = false;
+					return;
+				}
+				if(t.hash != hash) {
+					LOG_ERROR("Desync in turn %d: local state %08X, remote state %08X", turn, hash, t.hash);
+					netDesync = true;
+					gameStats.desyncs += 1;
+					isGameRunning = false;
+					return;
+				}
+			}
+			angle = apply_turn(player, &t);
+			replay_turn(&t);
+		}
+		else
+		{
+			uint32_t hash = state_hash();
+			do {
+				LOG_DEBUG("Battle setup");
+				player_build(player);
+				if(isGameRunning == false) return;
+			
+				LOG_DEBUG("Start aiming");
+			} while(player_aim(player, &angle) == false);
+			
+			// play through the turn record, so a replay (and the fixed point
+			// simulation) sees exactly the quantized values
+			turn_t t;
+			capture_turn(player, angle, &t);
+			t.hash = hash;
+			angle = apply_turn(player, &t);
+			replay_turn(&t);
+		}
+		launch_projectile(player, angle);
+		spectate_keyframe(true);
+		
+		LOG_DEBUG("Battle simulation");
+		battle_simulation();
+		if(isGameRunning == false) return;
+		
+		if(player == &leftBase) {
+			player = &rightBase;
+		} else {
+			player = &leftBase;
+		}
+	}
+}
+
+/**
+ * Returns a hash over the persistent game state (bases and affectors).
+ * Two peers in lockstep must get the same value at the start of each turn.
+ **/
+uint32_t state_hash()
+{
+	uint32_t hash = 2166136261u;
+#define HASH(v) do { \
+		uint32_t x; \
+		memcpy(&x, &(v), sizeof(x)); \
+		for(int b = 0; b < 4; b++) { \
+			hash ^= (x >> (8 * b)) & 0xFF; \
+			hash *= 16777619u; \
+		} \
+	} while(0)
+	
+	base_t const *bases[] = { &leftBase, &rightBase };
+	for(int i = 0; i < 2; i++) {
+		HASH(bases[i]->lifepoints);
+		for(int j = 0; j < 24; j++) {
+			HASH(bases[i]->protectors[j]);
+		}
+		for(int j = 0; j < AFFECTOR_TYPE_COUNT; j++) {
+			HASH(bases[i]->resources[j]);
+			HASH(bases[i]->respawn[j]);
+		}
+	}
+	for(int i = 0; i < affectorCount; i++) {
+		affector_t *a = &affectors[i];
+		int owner = (a->owner == &rightBase);
+		HASH(a->type);
+		HASH(owner);
+		HASH(a->center.x);
+		HASH(a->center.y);
+		HASH(a->rotation);
+		HASH(a->lifepoints);
+	}
+#undef HASH
+	return hash;
+}
+
+/**
+ * Records the affectors, resources and launch of a player.
+ **/
+void capture_turn(base_t *player, float angle, turn_t *turn)
+{
+	memset(turn, 0, sizeof(*turn));
+	turn->angle = lroundf(angle * 1000.0);
+	turn->time = lroundf(battleTime * 1000.0);
+	for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
+		turn->resources[i] = player->resources[i];
+	}
+	for(int i = 0; i < affectorCount; i++)
+	{
+		affector_t *a = &affectors[i];
+		if(a->owner != player) {
+			continue;
+		}
+		if(turn->count >= TURN_MAX_AFFECTORS) {
+			LOG_WARN("Too many affectors, only %d are transmitted.", TURN_MAX_AFFECTORS);
+			break;
+		}
+		turn_affector_t *ta = &turn->affectors[turn->count++];
+		ta->type = a->type;
+		ta->lifepoints = a->lifepoints;
+		ta->x = lroundf(a->center.x);
+		ta->y = lroundf(a->center.y);
+		ta->rotation = lroundf(a->rotation * 100.0);
+	}
+}
+
+/**
+ * Replaces the affectors and resources of a player with the ones
+ * of a turn record. Returns the launch angle.
+ * Both peers apply every turn through this, so the quantized values
+ * are the same on both sides.
+ **/
+float apply_turn(base_t *player, turn_t const *turn)
+{
+	// backwards, so swap-remove only moves affectors that were already checked
+	for(int i = affectorCount - 1; i >= 0; i--)
+	{
+		if(affectors[i].owner == player) {
+			affector_remove(&affectors[i]);
+		}
+	}
+	// the slots key battle_hash_event(), they must not depend on the build phase
+	affectors_renumber();
+	
+	for(int i = 0; i < turn->count; i++)
+	{
+		turn_affector_t const *ta = &turn->affectors[i];
+		affector_t *a = create_affector(player, ta->type, (float2){ ta->x, ta->y });
+		if(a == NULL) {
+			break;
+		}
+		a->rotation = ta->rotation / 100.0;
+		a->lifepoints = ta->lifepoints;
+	}
+	
+	for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
+		player->resources[i] = turn->resources[i];
+	}
+	battleTime = turn->time / 1000.0;
+	battleStartMs = turn->time;
+	
+	return turn->angle / 1000.0;
+}
+
+/**
+ * Checks a turn record against the rules before apply_turn(), for turns
+ * from untrusted sources. Building only moves affectors between the
+ * resources and the battleground, so per type the resources plus the
+ * affectors of the player stay the same (unless capture_turn() had to
+ * drop affectors). Affectors are placed on the battleground with at most
+ * the lifepoints of a new one, the launch is in the range of aim_angle()
+ * and not earlier than the start of the turn.
+ **/
+bool turn_legal(base_t const *player, turn_t const *turn)
+{
+	int before[AFFECTOR_TYPE_COUNT] = { 0 };
+	int after[AFFECTOR_TYPE_COUNT] = { 0 };
+	for(int i = 0; i < affectorCount; i++) {
+		if(affectors[i].owner == player) {
+			before[affectors[i].type] += 1;
+		}
+	}
+	for(int i = 0; i < turn->count; i++)
+	{
+		turn_affector_t const *ta = &turn->affectors[i];
+		if(ta->x < 0 || ta->x > battleground.w || ta->y < 0 || ta->y > battleground.h) {
+			return false;
+		}
+		if(ta->lifepoints > AFFECTOR_LIFE) {
+			return false;
+		}
+		after[ta->type] += 1;
+	}
+	for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++)
+	{
+		int total = player->resources[i] + before[i];
+		int recorded = turn->resources[i] + after[i];
+		if(recorded > total || (recorded < total && turn->count < TURN_MAX_AFFECTORS)) {
+			return false;
+		}
+	}
+	if(turn->angle < 15000 || turn->angle > 165000) {
+		return false;
+	}
+	return turn->time >= lroundf(battleTime * 1000.0);
+}
+
+/**
+ * Reads the blocks of a level file. Returns the number of blocks
+ * or -1 if the file can't be read.
+ **/
+int read_level(const char *file, SDL_Rect *blocks, int maxBlocks)
+{
+	FILE *f = fopen(file, "r");
+	if(f == NULL) {
+		return -1;
+	}
+
+	fscanf(f, "iAIM Level 1.0\n");
+	if(ferror(f)) {
+		fclose(f);
+		return -1;
+	}
+	
+	int count = 0;
+	SDL_Rect block;
+	while(count < maxBlocks && fscanf(f, "%d,%d,%d,%d", &block.x, &block.y, &block.w, &block.h) == 4)
+	{
+		blocks[count++] = block;
+	}
+	if(ferror(f)) {
+		count = -1;
+	}
+	fclose(f);
+	return count;
+}
+
+/**
+ * Replaces the blocks of the current level.
+ **/
+void set_level(SDL_Rect const *blocks, int count)
+{
+	// clean current level first:
+	arena_reset(&levelArena);
+	blockchain = NULL;
+	levelVersion += 1;
+	
+	for(int i = 0; i < count; i++)
+	{
+		block_t *b = arena_alloc(&levelArena, sizeof(block_t));
+		b->next = blockchain;
+		b->rect = blocks[i];
+		blockchain = b;
+	}
+}
+
+void load_level(const char *file)
+{
+	SDL_Rect blocks[LEVEL_MAX_BLOCKS];
+	int count = read_level(file, blocks, LEVEL_MAX_BLOCKS);
+	if(count < 0) {
+		fprintf(stderr, "Failed to load level %s\n", file);
+		exit(1);
+	}
+	set_level(blocks, count);
+}
+
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	
+	arena_chunk_t *c = arena->current;
+	while(c != NULL && c->used + size > c->size && c->next != NULL) {
+		c = c->next;
+	}
+	if(c == NULL || c->used + size > c->size) {
+		size_t capacity = MAX(size, ARENA_CHUNK_SIZE);
+		arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + capacity);
+		if(chunk == NULL) {
+			fprintf(stderr, "Out of memory in %s arena\n", arena->name);
+			exit(1);
+		}
+		chunk->next = NULL;
+		chunk->used = 0;
+		chunk->size = capacity;
+		if(c != NULL) {
+			c->next = chunk;
+		} else {
+			arena->chunks = chunk;
+		}
+		arena->reserved += capacity;
+		c = chunk;
+	}
+	arena->current = c;
+	
+	void *ptr = (char*)c->data + c->used;
+	c->used += size;
+	
+	arena->allocations++;
+	arena->totalAllocations++;
+	arena->bytes += size;
+	arena->peakBytes = MAX(arena->peakBytes, arena->bytes);
+	
+	return ptr;
+}
+
+/**
+ * Releases everything allocated from the arena. The memory stays
+ * reserved for the next allocations.
+ **/
+void arena_reset(arena_t *arena)
+{
+	for(arena_chunk_t *c = arena->chunks; c != NULL; c = c->next) {
+		c->used = 0;
+	}
+	arena->current = arena->chunks;
+	arena->allocations = 0;
+	arena->bytes = 0;
+	arena->resets++;
+}
+
+void arena_report(FILE *f)
+{
+	arena_t const *arenas[] = { &levelArena, &matchArena, &turnArena };
+	for(int i = 0; i < 3; i++) {
+		arena_t const *a = arenas[i];
+		fprintf(f, "%-5s arena: %d allocations (%ld total), %lu bytes, peak %lu bytes, %lu reserved, %d resets\n",
+			a->name,
+			a->allocations,
+			a->totalAllocations,
+			(unsigned long)a->bytes,
+			(unsigned long)a->peakBytes,
+			(unsigned long)a->reserved,
+			a->resets);
+	}
+}
+
+void rng_seed(rng_t *rng, uint64_t seed, uint64_t stream)
+{
+	rng->state = 0;
+	rng->inc = (stream << 1) | 1;
+	rng_next(rng);
+	rng->state += seed;
+	rng_next(rng);
+}
+
+uint32_t rng_next(rng_t *rng)
+{
+	uint64_t old = rng->state;
+	rng->state = old * 6364136223846793005ull + rng->inc;
+	uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+	uint32_t rot = old >> 59;
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/**
+ * Returns a number in [0, n).
+ **/
+uint32_t rng_range(rng_t *rng, uint32_t n)
+{
+	return ((uint64_t)rng_next(rng) * n) >> 32;
+}
+
+/**
+ * Seed for a new match, different on every call.
+ **/
+uint32_t rng_new_seed()
+{
+	uint64_t x = SDL_GetPerformanceCounter() + 0x9E3779B97F4A7C15ull * SDL_GetTicks();
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDull;
+	x ^= x >> 33;
+	return (uint32_t)x;
+}
+
+/**
+ * Adds the position of this tick to the trail of a projectile.
+ **/
+void trail_push(projectile_t *p, float2 pos)
+{
+	p->trailHead = (p->trailHead + 1) % TRAIL_LENGTH;
+	p->trail[p->trailHead] = pos;
+	if(p->trailCount < TRAIL_LENGTH) {
+		p->trailCount++;
+	}
+	p->trailTick = battleTicks;
+}
+
+static projectile_t *new_projectile(base_t const * base)
+{
+	projectile_t *p = arena_alloc(&turnArena, sizeof(projectile_t));
+	p->base = base;
+	p->active = true;
+	p->id = battleProjectiles++;
+	p->spectateId = -1;
+	p->trailHead = 0;
+	p->trailCount = 0;
+	p->next = projectiles; 
+	// Prepend
+	projectiles = p;
+	return p;
+}
+
+void fire_projectile(base_t const * base, float2 pos, float2 vel)
+{
+	projectile_t *p = new_projectile(base);
+	p->pos = pos;
+	p->prevPos = pos;
+	p->vel = vel;
+	p->acc = field_acceleration(pos);
+	if(simulateEffects) {
+		trail_push(p, pos);
+	}
+}
+
+void fx_fire_projectile(base_t const * base, fixed2 pos, fixed2 vel)
+{
+	projectile_t *p = new_projectile(base);
+	p->fxPos = pos;
+	p->fxVel = vel;
+	p->fxAcc = fx_field_acceleration(pos);
+	p->pos = fx_to_float2(pos);
+	p->prevPos = p->pos;
+	p->vel = fx_to_float2(vel);
+	p->acc = fx_to_float2(p->fxAcc);
+	if(simulateEffects) {
+		trail_push(p, p->pos);
+	}
+}
+
+/**
+ * Allocates the affector storage of a match from the match arena.
+ **/
+void affectors_init()
+{
+	affectors = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(affector_t));
+	affectorSlots = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(affector_slot_t));
+	affectorFreeSlots = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(int));
+	affectorCount = 0;
+	for(int i = 0; i < AFFECTOR_MAX; i++) {
+		affectorSlots[i] = (affector_slot_t){ -1, 0 };
+		affectorFreeSlots[i] = AFFECTOR_MAX - 1 - i;
+	}
+	affectorFreeSlotCount = AFFECTOR_MAX;
+	
+	affector_pack_t *pack = &affectorPack;
+	pack->fieldX = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(float));
+	pack->fieldY = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(float));
+	pack->fieldSign = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(float));
+	pack->fxFieldX = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(fixed_t));
+	pack->fxFieldY = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(fixed_t));
+	pack->fxFieldSign = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(fixed_t));
+	pack->x = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(float));
+	pack->y = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(float));
+	pack->fxX = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(fixed_t));
+	pack->fxY = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(fixed_t));
+	pack->nodes = arena_alloc(&matchArena, FIELD_TREE_NODES * sizeof(field_node_t));
+	pack->order = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(int));
+	pack->scratch = arena_alloc(&matchArena, AFFECTOR_MAX * sizeof(int));
+	pack->valid = false;
+}
+
+static int field_tree_node(affector_pack_t *pack, fixed2 min, fixed_t size, int first, int count, int depth)
+{
+	int index = pack->nodeCount++;
+	field_node_t *node = &pack->nodes[index];
+	node->min = min;
+	node->size = size;
+	node->first = first;
+	node->count = count;
+	
+	float2 sum[2] = { { 0 } };
+	fixed2 fxSum[2] = { { 0 } };
+	int mass[2] = { 0, 0 };
+	for(int i = first; i < first + count; i++) {
+		int f = pack->order[i];
+		int s = (pack->fieldSign[f] > 0);
+		mass[s] += 1;
+		sum[s].x += pack->fieldX[f];
+		sum[s].y += pack->fieldY[f];
+		fxSum[s].x += pack->fxFieldX[f];
+		fxSum[s].y += pack->fxFieldY[f];
+	}
+	for(int s = 0; s < 2; s++) {
+		node->mass[s] = mass[s];
+		if(mass[s] > 0) {
+			node->center[s] = (float2){ sum[s].x / mass[s], sum[s].y / mass[s] };
+			node->fxCenter[s] = (fixed2){ fxSum[s].x / mass[s], fxSum[s].y / mass[s] };
+		}
+	}
+	for(int q = 0; q < 4; q++) {
+		node->children[q] = -1;
+	}
+	node->leaf = (count <= FIELD_TREE_LEAF || depth >= FIELD_TREE_DEPTH || pack->nodeCount + 4 > FIELD_TREE_NODES);
+	if(node->leaf) {
+		return index;
+	}
+	
+	// stable partition into the quadrants
+	fixed_t half = size / 2;
+	fixed2 mid = { min.x + half, min.y + half };
+	int counts[4] = { 0 };
+	int offsets[4];
+#define QUADRANT(f) ((pack->fxFieldX[f] >= mid.x) + 2 * (pack->fxFieldY[f] >= mid.y))
+	for(int i = first; i < first + count; i++) {
+		counts[QUADRANT(pack->order[i])] += 1;
+	}
+	offsets[0] = first;
+	for(int q = 1; q < 4; q++) {
+		offsets[q] = offsets[q - 1] + counts[q - 1];
+	}
+	for(int i = first; i < first + count; i++) {
+		int f = pack->order[i];
+		pack->scratch[offsets[QUADRANT(f)]++] = f;
+	}
+#undef QUADRANT
+	memcpy(&pack->order[first], &pack->scratch[first], count * sizeof(int));
+	
+	int start = first;
+	for(int q = 0; q < 4; q++) {
+		if(counts[q] == 0) {
+			continue;
+		}
+		fixed2 childMin = { min.x + (q & 1) * half, min.y + (q >> 1) * half };
+		int child = field_tree_node(pack, childMin, half, start, counts[q], depth + 1);
+		pack->nodes[index].children[q] = child;
+		start += counts[q];
+	}
+	return index;
+}
+
+static void field_tree_build(affector_pack_t *pack)
+{
+	pack->nodeCount = 0;
+	if(pack->fieldCount == 0) {
+		return;
+	}
+	fixed2 min = { pack->fxFieldX[0], pack->fxFieldY[0] };
+	fixed2 max = min;
+	for(int i = 0; i < pack->fieldCount; i++) {
+		pack->order[i] = i;
+		min.x = MIN(min.x, pack->fxFieldX[i]);
+		min.y = MIN(min.y, pack->fxFieldY[i]);
+		max.x = MAX(max.x, pack->fxFieldX[i]);
+		max.y = MAX(max.y, pack->fxFieldY[i]);
+	}
+	// a power of two, so the quadrants split evenly
+	fixed_t size = FX_ONE;
+	while(size <= MAX(max.x - min.x, max.y - min.y)) {
+		size *= 2;
+	}
+	field_tree_node(pack, min, size, 0, pack->fieldCount, 0);
+}
+
+/**
+ * Returns the packed affectors, rebuilt if an affector was added or
+ * removed or a projectile was launched since the last call (the build
+ * phase moves affectors without telling anybody).
+ * Both arrays keep the order of affectors, so the forces are summed up in
+ * the same order as always and old replays give the same result.
+ **/
+affector_pack_t const *affector_pack()
+{
+	affector_pack_t *pack = &affectorPack;
+	if(pack->valid) {
+		return pack;
+	}
+	pack->fieldCount = 0;
+	for(int i = 0; i < affectorCount; i++) {
+		affector_t const *a = &affectors[i];
+		// the float simulation doesn't keep fxCenter up to date
+		fixed2 fxCenter = gameOptions.fixedPoint ? a->fxCenter : fx_from_float2(a->center);
+		pack->x[i] = a->center.x;
+		pack->y[i] = a->center.y;
+		pack->fxX[i] = fxCenter.x;
+		pack->fxY[i] = fxCenter.y;
+		if(a->type == 0 || a->type == 1) {
+			int n = pack->fieldCount++;
+			pack->fieldX[n] = a->center.x;
+			pack->fieldY[n] = a->center.y;
+			pack->fieldSign[n] = (a->type == 0) ? -1.0f : 1.0f;
+			pack->fxFieldX[n] = fxCenter.x;
+			pack->fxFieldY[n] = fxCenter.y;
+			pack->fxFieldSign[n] = (a->type == 0) ? -1 : 1;
+		}
+	}
+	pack->count = affectorCount;
+	if(gameOptions.fieldTheta > 0) {
+		field_tree_build(pack);
+	}
+	pack->valid = true;
+	return pack;
+}
+
+/**
+ * Appends an affector. Returns NULL if there is no space left.
+ **/
+affector_t * create_affector(base_t const * owner, int type, float2 pos)
+{
+	if(affectorCount >= AFFECTOR_MAX) {
+		LOG_WARN("Too many affectors, can't place more than %d.", AFFECTOR_MAX);
+		return NULL;
+	}
+	int slot = affectorFreeSlots[--affectorFreeSlotCount];
+	affectorSlots[slot].index = affectorCount;
+	
+	affector_t *a = &affectors[affectorCount++];
+	a->type = type; /* 0=positive, 1=negative */
+	a->owner = owner;
+	a->center = pos;
+	a->rotation = 0;
+	a->lifepoints = AFFECTOR_LIFE;
+	a->slot = slot;
+	affectorPack.valid = false;
+	
+	return a;
+}
+
+void affector_remove(affector_t *a)
+{
+	int index = a - affectors;
+	
+	affector_slot_t *slot = &affectorSlots[a->slot];
+	slot->index = -1;
+	slot->generation = (slot->generation + 1) & ((1 << (30 - AFFECTOR_SLOT_BITS)) - 1);
+	affectorFreeSlots[affectorFreeSlotCount++] = a->slot;
+	
+	// fill the gap with the last affector
+	affectorCount--;
+	affectorPack.valid = false;
+	if(index != affectorCount) {
+		affectors[index] = affectors[affectorCount];
+		affectorSlots[affectors[index].slot].index = index;
+	}
+}
+
+void affectors_clear()
+{
+	while(affectorCount > 0) {
+		affector_remove(&affectors[affectorCount - 1]);
+	}
+}
+
+static int affector_slot_order(const void *a, const void *b)
+{
+	return ((affector_t const*)a)->slot - ((affector_t const*)b)->slot;
+}
+
+/**
+ * Gives the affectors the slots 0, 1, ... in the order of their old slots
+ * and puts the free slots back into their initial order. The slots then
+ * only depend on the turn records and the battles, not on what was placed
+ * and taken back in the build phase. Invalidates all handles.
+ **/
+void affectors_renumber()
+{
+	qsort(affectors, affectorCount, sizeof(affector_t), affector_slot_order);
+	for(int i = 0; i < AFFECTOR_MAX; i++) {
+		affector_slot_t *slot = &affectorSlots[i];
+		slot->index = (i < affectorCount) ? i : -1;
+		slot->generation = (slot->generation + 1) & ((1 << (30 - AFFECTOR_SLOT_BITS)) - 1);
+	}
+	for(int i = 0; i < affectorCount; i++) {
+		affectors[i].slot = i;
+	}
+	affectorFreeSlotCount = AFFECTOR_MAX - affectorCount;
+	for(int i = 0; i < affectorFreeSlotCount; i++) {
+		affectorFreeSlots[i] = AFFECTOR_MAX - 1 - i;
+	}
+	affectorPack.valid = false;
+}
+
+affector_handle_t affector_handle(affector_t const *a)
+{
+	return (affectorSlots[a->slot].generation << AFFECTOR_SLOT_BITS) | a->slot;
+}
+
+/**
+ * Returns the affector of a handle or NULL if it was removed.
+ **/
+affector_t *affector_get(affector_handle_t handle)
+{
+	if(handle == AFFECTOR_NONE) {
+		return NULL;
+	}
+	affector_slot_t const *slot = &affectorSlots[handle & (AFFECTOR_MAX - 1)];
+	if(slot->index < 0 || slot->generation != (handle >> AFFECTOR_SLOT_BITS)) {
+		return NULL;
+	}
+	return &affectors[slot->index];
+}
+
+/**
+ * Loads all resources used by the game.
+ **/
+void load_resources()
+{
+#define LOAD(tex, img) if((tex = IMG_LoadTexture(renderer, img)) == NULL) \
+	{ \
+		fprintf(stderr, "Failed to load " img ": %s\n", IMG_GetError()); \
+		exit(1); \
+	}
+#define SOUND(snd, file) if((snd = Mix_LoadWAV(file)) == NULL) \
+	{ \
+		fprintf(stderr, "Failed to load " file ": %s\n", Mix_GetError()); \
+		exit(1); \
+	}
+#define BUTTON(tex, img, imgp) \
+	LOAD(tex[BUTTON_NORMAL],  img "normal" imgp); \
+	LOAD(tex[BUTTON_HOVER],   img "hover" imgp); \
+	LOAD(tex[BUTTON_PRESSED], img "press" imgp)
+	
+	
+	LOAD(texPlayArea, "tex/play-area.png");
+	LOAD(texBase, "tex/base.png");
+	LOAD(texBaseShips, "tex/base-bg.png");
+	LOAD(texNumbers, "tex/numbers.png");
+	LOAD(texMetal, "tex/metalbackground.png");
+	LOAD(texBackPanel, "tex/sidepanel.png");
+	LOAD(texLeftPanel, "tex/left-panel.png");
+	LOAD(texRightPanel, "tex/right-panel.png");
+	LOAD(texParticle, "tex/particles.png");
+	LOAD(texProjectile, "tex/projectile.png");
+	LOAD(texBarricade[0], "tex/barricade-0.png");
+	LOAD(texBarricade[1], "tex/barricade-1.png");
+	LOAD(texBarricade[2], "tex/barricade-2.png");
+	LOAD(texAffector[0], "tex/positive-affector.png");
+	LOAD(texAffector[1], "tex/negative-affector.png");
+	LOAD(texAffector[2], "tex/boost-affector.png");
+	LOAD(texAffector[3], "tex/split3-affector.png");
+	LOAD(texAffector[4], "tex/split2-affector.png");
+	
+	LOAD(texMenuBackground, "tex/mainmenu-bg.png");
+	LOAD(texMenuItems, "tex/mainmenu-items.png");
+	LOAD(texMenuSelector, "tex/mainmenu-selector.png");
+	LOAD(texMenuHelp, "tex/helpmenu.png");
+	
+	LOAD(texCredits, "tex/credits.png");
+	
+	LOAD(texFinalBlue, "tex/winscreen-blue.png");
+	LOAD(texFinalGreen, "tex/winscreen-green.png");
+	
+	LOAD(texLevelBackground, "tex/levelselection.png");
+	LOAD(texLevelSelector, "tex/level-selector.png");
+	LOAD(texLevels[0], "levels/01.png");
+	LOAD(texLevels[1], "levels/02.png");
+	LOAD(texLevels[2], "levels/03.png");
+	LOAD(texLevels[3], "levels/04.png");
+	
+	BUTTON(texButtonLaunch, "tex/launch-button-", ".png");
+	BUTTON(texButtonBack, "tex/back-button-", ".png");
+	
+	SOUND(sounds[SND_STARTUP], "sounds/startup.wav");
+	SOUND(sounds[SND_LAUNCH], "sounds/launch.wav");
+	SOUND(sounds[SND_SPLIT2], "sounds/split2.wav");
+	SOUND(sounds[SND_SPLIT3], "sounds/split3.wav");
+	SOUND(sounds[SND_BOOST], "sounds/boost.wav");
+	SOUND(sounds[SND_IMPACT_BARRICADE], "sounds/barricade.wav");
+	SOUND(sounds[SND_IMPACT_WALL], "sounds/crush.wav");
+	SOUND(sounds[SND_IMPACT_BASE], "sounds/base.wav");
+	
+#undef BUTTON
+#undef SOUND
+#undef LOAD
+}
+
+
+/**
+ * Network protocol: every message is a type byte, a 16 bit
+ * payload length and the payload, all little endian.
+ **/
+#define NET_MSG_HELLO 1
+#define NET_MSG_TURN  2
+
+#define NET_MAX_MESSAGE (32 + 9 * TURN_MAX_AFFECTORS)
+
+#define OPTIONS_SIZE 15
+
+static uint8_t *put_u8(uint8_t *p, uint8_t v)
+{
+	*p++ = v;
+	return p;
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+	p = put_u8(p, v);
+	return put_u8(p, v >> 8);
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+	p = put_u16(p, v);
+	return put_u16(p, v >> 16);
+}
+
+static uint8_t const *get_u8(uint8_t const *p, uint8_t *v)
+{
+	*v = p[0];
+	return p + 1;
+}
+
+static uint8_t const *get_u16(uint8_t const *p, uint16_t *v)
+{
+	*v = p[0] | (p[1] << 8);
+	return p + 2;
+}
+
+static uint8_t const *get_u32(uint8_t const *p, uint32_t *v)
+{
+	*v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	return p + 4;
+}
+
+/**
+ * Encodes the level, the game options and the match seed (OPTIONS_SIZE bytes).
+ **/
+uint8_t *options_encode(uint8_t *p, int level)
+{
+	p = put_u8(p, level);
+	p = put_u8(p, gameOptions.useSlowAiming);
+	p = put_u8(p, gameOptions.affectorsStay);
+	p = put_u8(p, gameOptions.rotatingProtectors);
+	p = put_u16(p, gameOptions.affectorLifespan);
+	p = put_u8(p, gameOptions.protectorLifespan);
+	p = put_u8(p, gameOptions.baseLifespan);
+	p = put_u8(p, gameOptions.fixedPoint);
+	p = put_u16(p, gameOptions.fieldTheta);
+	p = put_u32(p, matchSeed);
+	return p;
+}
+
+uint8_t const *options_decode(uint8_t const *p, int *level)
+{
+	uint8_t value;
+	uint16_t lifespan;
+	p = get_u8(p, &value);
+	*level = value;
+	p = get_u8(p, &value);
+	gameOptions.useSlowAiming = value;
+	p = get_u8(p, &value);
+	gameOptions.affectorsStay = value;
+	p = get_u8(p, &value);
+	gameOptions.rotatingProtectors = value;
+	p = get_u16(p, &lifespan);
+	gameOptions.affectorLifespan = lifespan;
+	p = get_u8(p, &value);
+	gameOptions.protectorLifespan = value;
+	p = get_u8(p, &value);
+	gameOptions.baseLifespan = value;
+	p = get_u8(p, &value);
+	gameOptions.fixedPoint = value;
+	uint16_t theta;
+	p = get_u16(p, &theta);
+	gameOptions.fieldTheta = MIN(theta, 1000);
+	p = get_u32(p, &matchSeed);
+	return p;
+}
+
+int turn_encode(turn_t const *turn, uint8_t *buffer)
+{
+	uint8_t *p = buffer;
+	p = put_u32(p, turn->hash);
+	p = put_u32(p, turn->angle);
+	p = put_u32(p, turn->time);
+	for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
+		p = put_u8(p, turn->resources[i]);
+	}
+	p = put_u8(p, turn->count);
+	for(int i = 0; i < turn->count; i++) {
+		turn_affector_t const *a = &turn->affectors[i];
+		p = put_u8(p, a->type);
+		p = put_u16(p, a->lifepoints);
+		p = put_u16(p, a->x);
+		p = put_u16(p, a->y);
+		p = put_u16(p, a->rotation);
+	}
+	return p - buffer;
+}
+
+bool turn_decode(uint8_t const *buffer, int len, turn_t *turn)
+{
+	uint8_t const *p = buffer;
+	uint8_t count;
+	if(len < (13 + AFFECTOR_TYPE_COUNT)) {
+		return false;
+	}
+	memset(turn, 0, sizeof(*turn));
+	p = get_u32(p, &turn->hash);
+	p = get_u32(p, (uint32_t*)&turn->angle);
+	p = get_u32(p, &turn->time);
+	for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
+		p = get_u8(p, &turn->resources[i]);
+	}
+	p = get_u8(p, &count);
+	if(len != (p - buffer) + 9 * count) {
+		return false;
+	}
+	turn->count = count;
+	for(int i = 0; i < turn->count; i++) {
+		turn_affector_t *a = &turn->affectors[i];
+		p = get_u8(p, &a->type);
+		p = get_u16(p, &a->lifepoints);
+		p = get_u16(p, (uint16_t*)&a->x);
+		p = get_u16(p, (uint16_t*)&a->y);
+		p = get_u16(p, (uint16_t*)&a->rotation);
+		if(a->type >= AFFECTOR_TYPE_COUNT) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool net_send_message(int type, uint8_t const *payload, int len)
+{
+	uint8_t header[3];
+	put_u16(put_u8(header, type), len);
+	return net_write(header, 3) && net_write(payload, len);
+}
+
+/**
+ * Reads one message into payload, which holds capacity bytes. Returns its
+ * type, or -1 if the connection failed or the message doesn't fit.
+ **/
+int net_receive_message(uint8_t *payload, int capacity, int *len)
+{
+	uint8_t header[3];
+	uint8_t type;
+	uint16_t size;
+	if(net_read(header, 3) == false) {
+		return -1;
+	}
+	get_u16(get_u8(header, &type), &size);
+	if(size > capacity || net_read(payload, size) == false) {
+		return -1;
+	}
+	*len = size;
+	return type;
+}
+
+/**
+ * Connects both peers. The host sends the level and the game options,
+ * so both play by the same rules.
+ **/
+bool net_start()
+{
+	uint8_t buffer[16];
+	uint8_t *p = buffer;
+	if(netMode == NET_HOST)
+	{
+		LOG_INFO("Waiting for a player on port %d...", netPort);
+		if(net_listen(netPort) == false) {
+			return false;
+		}
+		matchSeed = rng_new_seed();
+		p = options_encode(p, netLevel);
+		if(net_send_message(NET_MSG_HELLO, buffer, p - buffer) == false) {
+			return false;
+		}
+		netLocalPlayer = &leftBase;
+	}
+	else
+	{
+		LOG_INFO("Connecting to %s:%d...", netHost, netPort);
+		if(net_connect(netHost, netPort) == false) {
+			return false;
+		}
+		int len;
+		if(net_receive_message(buffer, sizeof(buffer), &len) != NET_MSG_HELLO || len != OPTIONS_SIZE) {
+			LOG_ERROR("Invalid handshake from %s:%d", netHost, netPort);
+			return false;
+		}
+		options_decode(buffer, &netLevel);
+		netLocalPlayer = &rightBase;
+	}
+	return true;
+}
+
+bool net_send_turn(turn_t const *turn)
+{
+	uint8_t buffer[NET_MAX_MESSAGE];
+	int len = turn_encode(turn, buffer);
+	return net_send_message(NET_MSG_TURN, buffer, len);
+}
+
+/**
+ * Shows the battleground until the turn of the remote player arrived.
+ **/
+bool net_receive_turn(base_t *player, turn_t *turn)
+{
+	uint64_t lastFrame = SDL_GetPerformanceCounter();
+	gameStats.phase = STATS_PHASE_REMOTE;
+	while(net_readable() == false)
+	{
+		SDL_Event e;
+		while(SDL_PollEvent(&e))
+		{
+			if(e.type == SDL_QUIT) exit(1);
+			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) {
+				return false;
+			}
+		}
+		
+		SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+		SDL_RenderClear(renderer);
+		
+		render_battleground();
+		battleTime += frame_time(&lastFrame);
+		
+		render_tool_panels(NULL);
+		
+		spectate_flush();
+		
+		frame_present();
+		SDL_Delay(16);
+	}
+	
+	uint8_t buffer[NET_MAX_MESSAGE];
+	int len;
+	if(net_receive_message(buffer, sizeof(buffer), &len) != NET_MSG_TURN || turn_decode(buffer, len, turn) == false) {
+		LOG_ERROR("Connection to the other player lost.");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Replays: REPLAY_MAGIC, the level, game options and seed (see options_encode())
+ * and then every turn as a 16 bit length followed by the encoded turn.
+ * After each turn follows its battle: a 16 bit tick count and battleHash
+ * after every tick. Only the battle of the last turn can be missing,
+ * when the match was quit during it.
+ **/
+#define REPLAY_MAGIC "iAIMRPL7"
+
+FILE *replayOutput = NULL;
+
+struct {
+	uint32_t hashes[BATTLE_MAX_TICKS + 1];
+	int count;
+} replayBattle;
+
+void replay_begin(const char *file, int level)
+{
+	if(replayOutput != NULL) {
+		fclose(replayOutput);
+	}
+	replayOutput = fopen(file, "wb");
+	if(replayOutput == NULL) {
+		LOG_ERROR("Failed to create replay %s", file);
+		return;
+	}
+	replay_start(level);
+}
+
+/**
+ * Writes the header of a replay into replayOutput.
+ **/
+void replay_start(int level)
+{
+	uint8_t buffer[OPTIONS_SIZE];
+	fwrite(REPLAY_MAGIC, 1, 8, replayOutput);
+	fwrite(buffer, 1, options_encode(buffer, level) - buffer, replayOutput);
+	fflush(replayOutput);
+}
+
+void replay_turn(turn_t const *turn)
+{
+	uint8_t buffer[NET_MAX_MESSAGE];
+	if(replayOutput == NULL) {
+		return;
+	}
+	int len = turn_encode(turn, buffer + 2);
+	put_u16(buffer, len);
+	fwrite(buffer, 1, len + 2, replayOutput);
+	fflush(replayOutput);
+	replayBattle.count = 0;
+}
+
+void replay_tick()
+{
+	if(replayOutput == NULL || replayBattle.count > BATTLE_MAX_TICKS) {
+		return;
+	}
+	replayBattle.hashes[replayBattle.count++] = battleHash;
+}
+
+/**
+ * Writes the tick hashes of the finished battle.
+ **/
+void replay_battle()
+{
+	uint8_t buffer[4];
+	if(replayOutput == NULL) {
+		return;
+	}
+	put_u16(buffer, replayBattle.count);
+	fwrite(buffer, 1, 2, replayOutput);
+	for(int i = 0; i < replayBattle.count; i++) {
+		put_u32(buffer, replayBattle.hashes[i]);
+		fwrite(buffer, 1, 4, replayOutput);
+	}
+	fflush(replayOutput);
+	replayBattle.count = 0;
+}
+
+/**
+ * Reads the battle that follows a turn in a replay, *hashes is NULL
+ * if it wasn't recorded. Returns NULL if it is truncated.
+ **/
+static uint8_t const *replay_battle_decode(uint8_t const *p, uint8_t const *end, uint8_t const **hashes, int *count)
+{
+	uint16_t ticks;
+	*hashes = NULL;
+	*count = 0;
+	if(p == end) {
+		return p;
+	}
+	if((end - p) < 2) {
+		return NULL;
+	}
+	p = get_u16(p, &ticks);
+	if((end - p) < 4 * ticks) {
+		return NULL;
+	}
+	*hashes = p;
+	*count = ticks;
+	return p + 4 * ticks;
+}
+
+/**
+ * Checks battleHash after a tick against a recorded battle.
+ **/
+static bool replay_tick_differs(uint8_t const *hashes, int count, int tick)
+{
+	uint32_t hash;
+	if(tick >= count) {
+		return true;
+	}
+	get_u32(hashes + 4 * tick, &hash);
+	return hash != battleHash;
+}
+
+/**
+ * Spectator stream (--broadcast SOCKET, watched with --spectate SOCKET).
+ * Every battle tick is encoded once into a ring of messages which all
+ * viewers are sent from. A message is a 16 bit length and a type:
+ *   KEYFRAME: options (see options_encode()), battleTime in ms, battleTicks,
+ *             both bases, the affectors and the projectiles the viewers know
+ *   TICK:     changed lifepoints, protectors and affectors, then the
+ *             expired projectiles, new ones and position corrections
+ * Positions are sent in 1/SPECTATE_POS_SCALE pixel, velocities in the same
+ * unit per tick. Both ends move every known projectile by its last sent
+ * velocity each tick, so a correction only holds the difference to that
+ * prediction, as zigzag varints. New projectiles and corrections never
+ * take more than SPECTATE_TICK_BUDGET bytes of a tick: in a splitter
+ * cascade the projectiles that are furthest off are corrected first and
+ * the rest are announced or corrected in later ticks. Projectiles are sent
+ * by an id below SPECTATE_MAX_PROJECTILES which is reused once they
+ * expire. If more projectiles are active at once, the newest ones are
+ * announced when ids become free.
+ * Every turn puts a keyframe into the ring. Viewers that connect later
+ * get the latest keyframe first, which is taken again every
+ * SPECTATE_KEYFRAME_TICKS, and continue in the ring where it was taken.
+ **/
+#define SPECTATE_MSG_KEYFRAME 1
+#define SPECTATE_MSG_TICK     2
+
+#define SPECTATE_RING_SIZE       (1 << 18)
+#define SPECTATE_MAX_MESSAGE     32768
+#define SPECTATE_TICK_BUDGET     512
+#define SPECTATE_KEYFRAME_TICKS  120
+#define SPECTATE_MAX_PROJECTILES 1024
+#define SPECTATE_MAX_VIEWERS     16
+#define SPECTATE_POS_SCALE       16
+
+#define SPECTATE_UNKNOWN 0
+#define SPECTATE_ACTIVE  1
+#define SPECTATE_EXPIRED 2
+
+/**
+ * A projectile as the viewers know it.
+ **/
+typedef struct {
+	uint8_t state;
+	uint8_t owner;  // 0 = left base, 1 = right base
+	int32_t x, y;
+	int32_t vx, vy;
+} spectate_projectile_t;
+
+#define SPECTATE_KEYFRAME_SENT    -1
+#define SPECTATE_KEYFRAME_WAITING -2
+
+typedef struct {
+	int fd;
+	int keyframe;     // slot of the keyframe being sent or SPECTATE_KEYFRAME_*
+	int keyframeSent; // bytes of it
+	uint64_t offset;  // next byte of the ring to send
+} spectate_viewer_t;
+
+struct {
+	bool enabled;
+	uint8_t ring[SPECTATE_RING_SIZE];
+	uint64_t head;  // bytes ever written into the ring
+	uint8_t keyframes[2][2 + SPECTATE_MAX_MESSAGE]; // the latest and the one before
+	int keyframeLens[2];
+	int keyframe;   // slot of the latest, -1 before the first
+	uint64_t keyframeOffset;
+	int keyframeTick;
+	spectate_viewer_t viewers[SPECTATE_MAX_VIEWERS];
+	int viewerCount;
+	
+	// the state the viewers know, on both ends
+	spectate_projectile_t known[SPECTATE_MAX_PROJECTILES];
+	int freeIds[SPECTATE_MAX_PROJECTILES];
+	int freeIdCount;
+	bool idsWarned; // this turn
+	int lifepoints[2];
+	int protectors[2][24];
+	uint8_t affectors[SPECTATE_MAX_MESSAGE];
+	int affectorsLen;
+	
+	// only used by the viewer
+	projectile_t *views[SPECTATE_MAX_PROJECTILES];
+	bool synced;
+} spectate;
+
+static uint8_t *put_varint(uint8_t *p, uint32_t v)
+{
+	while(v >= 0x80) {
+		*p++ = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static uint8_t *put_zigzag(uint8_t *p, int32_t v)
+{
+	return put_varint(p, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+/**
+ * Returns NULL if the varint doesn't end before end.
+ **/
+static uint8_t const *get_varint(uint8_t const *p, uint8_t const *end, uint32_t *v)
+{
+	*v = 0;
+	for(int shift = 0; p < end && shift < 35; shift += 7) {
+		*v |= (uint32_t)(*p & 0x7F) << shift;
+		if((*p++ & 0x80) == 0) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static uint8_t const *get_zigzag(uint8_t const *p, uint8_t const *end, int32_t *v)
+{
+	uint32_t u;
+	p = get_varint(p, end, &u);
+	*v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+	return p;
+}
+
+static int32_t spectate_quantize(float v)
+{
+	return (int32_t)lroundf(v * SPECTATE_POS_SCALE);
+}
+
+static uint8_t *spectate_put_projectile(uint8_t *p, int id, spectate_projectile_t const *s)
+{
+	p = put_varint(p, id);
+	p = put_u8(p, s->owner);
+	p = put_zigzag(p, s->x);
+	p = put_zigzag(p, s->y);
+	p = put_zigzag(p, s->vx);
+	return put_zigzag(p, s->vy);
+}
+
+/**
+ * Encodes all affectors into spectate.affectors, returns true if
+ * they changed since the last call.
+ **/
+static bool spectate_encode_affectors()
+{
+	static uint8_t buffer[SPECTATE_MAX_MESSAGE];
+	uint8_t *p = put_varint(buffer, affectorCount);
+	for(int i = 0; i < affectorCount; i++) {
+		affector_t const *a = &affectors[i];
+		p = put_u8(p, a->type);
+		p = put_u8(p, a->owner == &rightBase);
+		p = put_u16(p, (int16_t)a->center.x);
+		p = put_u16(p, (int16_t)a->center.y);
+		p = put_u16(p, (int16_t)(a->rotation * 100));
+		p = put_u8(p, a->lifepoints);
+	}
+	int len = p - buffer;
+	if(len == spectate.affectorsLen && memcmp(buffer, spectate.affectors, len) == 0) {
+		return false;
+	}
+	memcpy(spectate.affectors, buffer, len);
+	spectate.affectorsLen = len;
+	return true;
+}
+
+/**
+ * Starts sending the latest keyframe to a viewer, or lets it wait for
+ * the next one if the ring already moved past it.
+ **/
+static void spectate_join(spectate_viewer_t *viewer)
+{
+	if(spectate.keyframe < 0 || (spectate.head - spectate.keyframeOffset) > SPECTATE_RING_SIZE / 2) {
+		viewer->keyframe = SPECTATE_KEYFRAME_WAITING;
+		return;
+	}
+	viewer->keyframe = spectate.keyframe;
+	viewer->keyframeSent = 0;
+	viewer->offset = spectate.keyframeOffset;
+}
+
+static void spectate_publish(uint8_t const *message, int len)
+{
+	uint8_t header[2];
+	put_u16(header, len);
+	for(int i = 0; i < 2; i++) {
+		spectate.ring[spectate.head++ % SPECTATE_RING_SIZE] = header[i];
+	}
+	for(int i = 0; i < len; i++) {
+		spectate.ring[spectate.head++ % SPECTATE_RING_SIZE] = message[i];
+	}
+}
+
+/**
+ * Takes a keyframe of the current state for viewers that join. With
+ * reset, the viewers forget all projectiles (a new turn started) and the
+ * keyframe is also sent to everybody.
+ **/
+void spectate_keyframe(bool reset)
+{
+	if(spectate.enabled == false) {
+		return;
+	}
+	// the older slot is overwritten, it may still be sent to a slow viewer
+	int slot = (spectate.keyframe == 0) ? 1 : 0;
+	for(int i = 0; i < spectate.viewerCount; i++) {
+		if(spectate.viewers[i].keyframe != slot) {
+			continue;
+		}
+		if(reset == false) {
+			return;
+		}
+		LOG_WARN("Spectator %d is too slow to join", i);
+		spectate_drop(i--);
+	}
+	if(reset) {
+		memset(spectate.known, 0, sizeof(spectate.known));
+		for(int i = 0; i < SPECTATE_MAX_PROJECTILES; i++) {
+			spectate.freeIds[i] = SPECTATE_MAX_PROJECTILES - 1 - i;
+		}
+		spectate.freeIdCount = SPECTATE_MAX_PROJECTILES;
+		spectate.idsWarned = false;
+	}
+	
+	base_t const *bases[2] = { &leftBase, &rightBase };
+	uint8_t *message = spectate.keyframes[slot] + 2;
+	uint8_t *p = put_u8(message, SPECTATE_MSG_KEYFRAME);
+	p = options_encode(p, currentLevel);
+	p = put_u32(p, (uint32_t)lroundf(battleTime * 1000));
+	p = put_u32(p, battleTicks);
+	for(int i = 0; i < 2; i++) {
+		spectate.lifepoints[i] = bases[i]->lifepoints;
+		p = put_u8(p, (int8_t)bases[i]->lifepoints);
+		for(int j = 0; j < 24; j++) {
+			spectate.protectors[i][j] = bases[i]->protectors[j];
+			p = put_u8(p, bases[i]->protectors[j]);
+		}
+	}
+	spectate_encode_affectors();
+	memcpy(p, spectate.affectors, spectate.affectorsLen);
+	p += spectate.affectorsLen;
+	
+	int count = 0;
+	for(int id = 0; id < SPECTATE_MAX_PROJECTILES; id++) {
+		count += (spectate.known[id].state == SPECTATE_ACTIVE);
+	}
+	p = put_varint(p, count);
+	for(int id = 0; id < SPECTATE_MAX_PROJECTILES; id++) {
+		if(spectate.known[id].state == SPECTATE_ACTIVE) {
+			p = spectate_put_projectile(p, id, &spectate.known[id]);
+		}
+	}
+	
+	int len = p - message;
+	put_u16(spectate.keyframes[slot], len);
+	spectate.keyframeLens[slot] = len + 2;
+	spectate.keyframe = slot;
+	spectate.keyframeTick = battleTicks;
+	if(reset) {
+		spectate_publish(message, len);
+	}
+	spectate.keyframeOffset = spectate.head;
+	for(int i = 0; i < spectate.viewerCount; i++) {
+		if(spectate.viewers[i].keyframe == SPECTATE_KEYFRAME_WAITING) {
+			spectate_join(&spectate.viewers[i]);
+		}
+	}
+}
+
+typedef struct {
+	int id;
+	int32_t error;
+} spectate_correction_t;
+
+static int compare_corrections(const void *a, const void *b)
+{
+	spectate_correction_t const *x = a, *y = b;
+	if(x->error != y->error) {
+		return (x->error < y->error) ? 1 : -1;
+	}
+	return x->id - y->id;
+}
+
+#define SPECTATE_MAX_SPAWNS (SPECTATE_TICK_BUDGET / 6) // a spawn takes at least 6 bytes
+
+/**
+ * Publishes the last battle tick.
+ **/
+void spectate_tick()
+{
+	static uint8_t message[SPECTATE_MAX_MESSAGE];
+	static uint8_t spawns[SPECTATE_TICK_BUDGET];
+	static uint8_t updates[SPECTATE_TICK_BUDGET];
+	static int expired[SPECTATE_MAX_PROJECTILES];
+	static spectate_correction_t corrections[SPECTATE_MAX_PROJECTILES];
+	static projectile_t *byId[SPECTATE_MAX_PROJECTILES];
+	static projectile_t *pending[SPECTATE_MAX_SPAWNS];
+	
+	if(spectate.enabled == false) {
+		return;
+	}
+	
+	base_t const *bases[2] = { &leftBase, &rightBase };
+	uint8_t *p = put_u8(message, SPECTATE_MSG_TICK);
+	uint8_t *flags = p++;
+	*flags = 0;
+	if(leftBase.lifepoints != spectate.lifepoints[0] || rightBase.lifepoints != spectate.lifepoints[1]) {
+		*flags |= 1;
+		for(int i = 0; i < 2; i++) {
+			spectate.lifepoints[i] = bases[i]->lifepoints;
+			p = put_u8(p, (int8_t)bases[i]->lifepoints);
+		}
+	}
+	if(spectate_encode_affectors()) {
+		*flags |= 2;
+		memcpy(p, spectate.affectors, spectate.affectorsLen);
+		p += spectate.affectorsLen;
+	}
+	int changes = 0;
+	for(int i = 0; i < 2; i++) {
+		for(int j = 0; j < 24; j++) {
+			changes += (bases[i]->protectors[j] != spectate.protectors[i][j]);
+		}
+	}
+	p = put_varint(p, changes);
+	for(int i = 0; i < 2; i++) {
+		for(int j = 0; j < 24; j++) {
+			if(bases[i]->protectors[j] != spectate.protectors[i][j]) {
+				spectate.protectors[i][j] = bases[i]->protectors[j];
+				p = put_u8(p, 24 * i + j);
+				p = put_u8(p, bases[i]->protectors[j]);
+			}
+		}
+	}
+	
+	// both ends predict the known projectiles first, expired ones free their id
+	memset(byId, 0, sizeof(byId));
+	int pendingCount = 0;
+	for(projectile_t *q = projectiles; q != NULL; q = q->next) {
+		if(q->active && q->spectateId >= 0) {
+			byId[q->spectateId] = q;
+		}
+		if(q->active && q->spectateId < 0) {
+			// the list starts with the newest, so this keeps the oldest
+			pending[pendingCount++ % SPECTATE_MAX_SPAWNS] = q;
+		}
+	}
+	int expiredCount = 0, correctionCount = 0;
+	for(int id = 0; id < SPECTATE_MAX_PROJECTILES; id++)
+	{
+		spectate_projectile_t *s = &spectate.known[id];
+		if(s->state != SPECTATE_ACTIVE) {
+			continue;
+		}
+		s->x += s->vx;
+		s->y += s->vy;
+		if(byId[id] == NULL) {
+			s->state = SPECTATE_EXPIRED;
+			expired[expiredCount++] = id;
+			spectate.freeIds[spectate.freeIdCount++] = id;
+			continue;
+		}
+		int32_t error =
+			abs(spectate_quantize(byId[id]->pos.x) - s->x) +
+			abs(spectate_quantize(byId[id]->pos.y) - s->y);
+		if(error > 0) {
+			corrections[correctionCount++] = (spectate_correction_t){ id, error };
+		}
+	}
+	p = put_varint(p, expiredCount);
+	for(int i = 0; i < expiredCount; i++) {
+		p = put_varint(p, expired[i]);
+	}
+	
+	int budget = SPECTATE_TICK_BUDGET - 6; // the two counts
+	uint8_t *s = spawns;
+	int spawnCount = 0;
+	for(int i = 0; i < MIN(pendingCount, SPECTATE_MAX_SPAWNS); i++)
+	{
+		projectile_t *q = pending[(pendingCount - 1 - i) % SPECTATE_MAX_SPAWNS];
+		if(spectate.freeIdCount == 0) {
+			if(spectate.idsWarned == false) {
+				LOG_WARN("More than %d projectiles at once, spectators see the others late", SPECTATE_MAX_PROJECTILES);
+				spectate.idsWarned = true;
+			}
+			break;
+		}
+		int id = spectate.freeIds[spectate.freeIdCount - 1];
+		spectate_projectile_t known = {
+			SPECTATE_ACTIVE, q->base == &rightBase,
+			spectate_quantize(q->pos.x), spectate_quantize(q->pos.y),
+			spectate_quantize(q->vel.x * SIM_DT), spectate_quantize(q->vel.y * SIM_DT),
+		};
+		uint8_t entry[32];
+		int len = spectate_put_projectile(entry, id, &known) - entry;
+		if((s - spawns) + len > budget) {
+			break;
+		}
+		memcpy(s, entry, len);
+		s += len;
+		spawnCount++;
+		spectate.known[id] = known;
+		spectate.freeIdCount--;
+		q->spectateId = id;
+	}
+	budget -= s - spawns;
+	
+	qsort(corrections, correctionCount, sizeof(corrections[0]), compare_corrections);
+	uint8_t *u = updates;
+	int updateCount = 0;
+	for(int i = 0; i < correctionCount; i++)
+	{
+		int id = corrections[i].id;
+		spectate_projectile_t *k = &spectate.known[id];
+		projectile_t const *q = byId[id];
+		int32_t x = spectate_quantize(q->pos.x), y = spectate_quantize(q->pos.y);
+		int32_t vx = spectate_quantize(q->vel.x * SIM_DT), vy = spectate_quantize(q->vel.y * SIM_DT);
+		uint8_t entry[32];
+		uint8_t *e = put_varint(entry, id);
+		e = put_zigzag(e, x - k->x);
+		e = put_zigzag(e, y - k->y);
+		e = put_zigzag(e, vx - k->vx);
+		e = put_zigzag(e, vy - k->vy);
+		if((u - updates) + (e - entry) > budget) {
+			break;
+		}
+		memcpy(u, entry, e - entry);
+		u += e - entry;
+		updateCount++;
+		k->x = x;
+		k->y = y;
+		k->vx = vx;
+		k->vy = vy;
+	}
+	
+	p = put_varint(p, spawnCount);
+	memcpy(p, spawns, s - spawns);
+	p += s - spawns;
+	p = put_varint(p, updateCount);
+	memcpy(p, updates, u - updates);
+	p += u - updates;
+	spectate_publish(message, p - message);
+	
+	if(battleTicks - spectate.keyframeTick >= SPECTATE_KEYFRAME_TICKS) {
+		spectate_keyframe(false);
+	}
+}
+
+static void spectate_view(int id)
+{
+	spectate_projectile_t const *s = &spectate.known[id];
+	projectile_t *view = spectate.views[id];
+	view->prevPos = view->pos;
+	view->pos = (float2){ (float)s->x / SPECTATE_POS_SCALE, (float)s->y / SPECTATE_POS_SCALE };
+	view->vel = (float2){ (float)s->vx * SIM_RATE / SPECTATE_POS_SCALE, (float)s->vy * SIM_RATE / SPECTATE_POS_SCALE };
+	trail_push(view, view->pos);
+}
+
+static uint8_t const *spectate_read_projectile(uint8_t const *p, uint8_t const *end, int *id)
+{
+	uint32_t v;
+	uint8_t owner;
+	spectate_projectile_t s = { SPECTATE_ACTIVE };
+	if((p = get_varint(p, end, &v)) == NULL || v >= SPECTATE_MAX_PROJECTILES || p >= end) {
+		return NULL;
+	}
+	*id = v;
+	p = get_u8(p, &owner);
+	s.owner = (owner != 0);
+	if((p = get_zigzag(p, end, &s.x)) == NULL || (p = get_zigzag(p, end, &s.y)) == NULL ||
+	   (p = get_zigzag(p, end, &s.vx)) == NULL || (p = get_zigzag(p, end, &s.vy)) == NULL) {
+		return NULL;
+	}
+	spectate.known[*id] = s;
+	
+	projectile_t *view = new_projectile(s.owner ? &rightBase : &leftBase);
+	view->pos = (float2){ (float)s.x / SPECTATE_POS_SCALE, (float)s.y / SPECTATE_POS_SCALE };
+	view->prevPos = view->pos;
+	spectate.views[*id] = view;
+	return p;
+}
+
+static uint8_t const *spectate_read_affectors(uint8_t const *p, uint8_t const *end)
+{
+	uint32_t count;
+	if((p = get_varint(p, end, &count)) == NULL || (end - p) < 9 * (int64_t)count) {
+		return NULL;
+	}
+	affectors_clear();
+	for(uint32_t i = 0; i < count; i++)
+	{
+		uint8_t type, owner, lifepoints;
+		uint16_t x, y, rotation;
+		p = get_u8(p, &type);
+		p = get_u8(p, &owner);
+		p = get_u16(p, &x);
+		p = get_u16(p, &y);
+		p = get_u16(p, &rotation);
+		p = get_u8(p, &lifepoints);
+		if(type >= AFFECTOR_TYPE_COUNT) {
+			return NULL;
+		}
+		affector_t *a = create_affector(owner ? &rightBase : &leftBase, type, (float2){ (int16_t)x, (int16_t)y });
+		if(a != NULL) {
+			a->rotation = (int16_t)rotation / 100.0;
+			a->lifepoints = lifepoints;
+		}
+	}
+	return p;
+}
+
+/**
+ * Applies a message of the stream to the game state, which is then drawn
+ * like a battle. Returns false if the message is malformed.
+ **/
+bool spectate_apply(uint8_t const *message, int len)
+{
+	uint8_t const *p = message, *end = message + len;
+	base_t *bases[2] = { &leftBase, &rightBase };
+	uint8_t type, value;
+	uint32_t count, v;
+	if(len < 1) {
+		return false;
+	}
+	p = get_u8(p, &type);
+	
+	if(type == SPECTATE_MSG_KEYFRAME)
+	{
+		if((end - p) < OPTIONS_SIZE + 8 + 2 * 25) {
+			return false;
+		}
+		int level;
+		uint32_t timeMs, ticks;
+		p = options_decode(p, &level);
+		if(level != currentLevel || spectate.synced == false) {
+			SDL_Rect blocks[LEVEL_MAX_BLOCKS];
+			char name[256];
+			sprintf(name, "levels/%02d.txt", level);
+			int count = read_level(name, blocks, LEVEL_MAX_BLOCKS);
+			if(count < 0) {
+				LOG_ERROR("The game plays level %d which isn't installed", level);
+				return false;
+			}
+			set_level(blocks, count);
+			currentLevel = level;
+		}
+		match_init();
+		battle_reset();
+		p = get_u32(p, &timeMs);
+		p = get_u32(p, &ticks);
+		battleTime = timeMs / 1000.0;
+		battleTicks = ticks;
+		for(int i = 0; i < 2; i++) {
+			p = get_u8(p, &value);
+			bases[i]->lifepoints = (int8_t)value;
+			for(int j = 0; j < 24; j++) {
+				p = get_u8(p, &value);
+				bases[i]->protectors[j] = MIN(value, 3);
+			}
+		}
+		if((p = spectate_read_affectors(p, end)) == NULL || (p = get_varint(p, end, &count)) == NULL) {
+			return false;
+		}
+		memset(spectate.known, 0, sizeof(spectate.known));
+		for(uint32_t i = 0; i < count; i++) {
+			int id;
+			if((p = spectate_read_projectile(p, end, &id)) == NULL) {
+				return false;
+			}
+			trail_push(spectate.views[id], spectate.views[id]->pos);
+		}
+		spectate.synced = true;
+		return p == end;
+	}
+	if(type != SPECTATE_MSG_TICK || spectate.synced == false || p >= end) {
+		return false;
+	}
+	
+	uint8_t flags;
+	p = get_u8(p, &flags);
+	if(flags & 1) {
+		if((end - p) < 2) {
+			return false;
+		}
+		for(int i = 0; i < 2; i++) {
+			p = get_u8(p, &value);
+			bases[i]->lifepoints = (int8_t)value;
+		}
+	}
+	if((flags & 2) && (p = spectate_read_affectors(p, end)) == NULL) {
+		return false;
+	}
+	if((p = get_varint(p, end, &count)) == NULL || (end - p) < 2 * (int64_t)count) {
+		return false;
+	}
+	for(uint32_t i = 0; i < count; i++) {
+		uint8_t index;
+		p = get_u8(p, &index);
+		p = get_u8(p, &value);
+		if(index >= 48) {
+			return false;
+		}
+		bases[index / 24]->protectors[index % 24] = MIN(value, 3);
+	}
+	
+	for(int id = 0; id < SPECTATE_MAX_PROJECTILES; id++) {
+		spectate_projectile_t *s = &spectate.known[id];
+		if(s->state == SPECTATE_ACTIVE) {
+			s->x += s->vx;
+			s->y += s->vy;
+		}
+	}
+	if((p = get_varint(p, end, &count)) == NULL) {
+		return false;
+	}
+	for(uint32_t i = 0; i < count; i++) {
+		if((p = get_varint(p, end, &v)) == NULL || v >= SPECTATE_MAX_PROJECTILES ||
+		   spectate.known[v].state != SPECTATE_ACTIVE) {
+			return false;
+		}
+		spectate.known[v].state = SPECTATE_EXPIRED;
+		spectate.views[v]->active = false;
+	}
+	if((p = get_varint(p, end, &count)) == NULL) {
+		return false;
+	}
+	for(uint32_t i = 0; i < count; i++) {
+		int id;
+		if((p = spectate_read_projectile(p, end, &id)) == NULL) {
+			return false;
+		}
+	}
+	if((p = get_varint(p, end, &count)) == NULL) {
+		return false;
+	}
+	for(uint32_t i = 0; i < count; i++) {
+		int32_t dx, dy, dvx, dvy;
+		if((p = get_varint(p, end, &v)) == NULL || v >= SPECTATE_MAX_PROJECTILES ||
+		   spectate.known[v].state != SPECTATE_ACTIVE ||
+		   (p = get_zigzag(p, end, &dx)) == NULL || (p = get_zigzag(p, end, &dy)) == NULL ||
+		   (p = get_zigzag(p, end, &dvx)) == NULL || (p = get_zigzag(p, end, &dvy)) == NULL) {
+			return false;
+		}
+		spectate.known[v].x += dx;
+		spectate.known[v].y += dy;
+		spectate.known[v].vx += dvx;
+		spectate.known[v].vy += dvy;
+	}
+	
+	for(int id = 0; id < SPECTATE_MAX_PROJECTILES; id++) {
+		if(spectate.known[id].state == SPECTATE_ACTIVE) {
+			spectate_view(id);
+		}
+	}
+	battleTicks += 1;
+	battleTime += SIM_DT;
+	return p == end;
+}
+
+/**
+ * Draws the state of the stream, the final screen once a base is destroyed.
+ **/
+void spectate_render()
+{
+	SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+	SDL_RenderClear(renderer);
+	if(spectate.synced == false) {
+		return;
+	}
+	render_battleground();
+	render_tool_panels(NULL);
+	if(leftBase.lifepoints < 0 || rightBase.lifepoints < 0) {
+		SDL_Rect fullscreen = { 0, 0, 1280, 720 };
+		SDL_RenderCopy(renderer, (leftBase.lifepoints < 0) ? texFinalGreen : texFinalBlue, NULL, &fullscreen);
+	}
+}
+
+/**
+ * Levels used by headless simulations, loaded once by levels_preload().
+ **/
+#define LEVEL_MAX_COUNT 99
+
+struct {
+	SDL_Rect blocks[LEVEL_MAX_BLOCKS];
+	int count;
+} levelCache[LEVEL_MAX_COUNT + 1];
+
+int levels_preload()
+{
+	int loaded = 0;
+	for(int i = 1; i <= LEVEL_MAX_COUNT; i++) {
+		char name[256];
+		sprintf(name, "levels/%02d.txt", i);
+		levelCache[i].count = read_level(name, levelCache[i].blocks, LEVEL_MAX_BLOCKS);
+		if(levelCache[i].count >= 0) {
+			loaded++;
+		}
+	}
+	return loaded;
+}
+
+/**
+ * Simulates a replay without any output. Runs on any thread.
+ * Returns false with *error set if the replay is malformed, its options
+ * are outside the ranges of load_options() or differ from rules (unless
+ * rules is NULL).
+ **/
+bool replay_verify(uint8_t const *data, int len, game_options_t const *rules, replay_result_t *result, const char **error)
+{
+	memset(result, 0, sizeof(*result));
+	result->desyncTurn = -1;
+	result->desyncTick = -1;
+	
+	if(len < (8 + OPTIONS_SIZE) || memcmp(data, REPLAY_MAGIC, 8) != 0) {
+		*error = "not a replay";
+		return false;
+	}
+	int level;
+	uint8_t const *p = options_decode(data + 8, &level);
+	uint8_t const *end = data + len;
+	if(level < 1 || level > LEVEL_MAX_COUNT || levelCache[level].count < 0) {
+		*error = "unknown level";
+		return false;
+	}
+	if(gameOptions.affectorLifespan < 1 ||
+	   gameOptions.protectorLifespan < 0 || gameOptions.protectorLifespan > 3 ||
+	   gameOptions.baseLifespan < 1 || gameOptions.baseLifespan > 10) {
+		*error = "illegal options";
+		return false;
+	}
+	if(rules != NULL && (
+	   gameOptions.useSlowAiming != rules->useSlowAiming ||
+	   gameOptions.affectorsStay != rules->affectorsStay ||
+	   gameOptions.rotatingProtectors != rules->rotatingProtectors ||
+	   gameOptions.affectorLifespan != rules->affectorLifespan ||
+	   gameOptions.protectorLifespan != rules->protectorLifespan ||
+	   gameOptions.baseLifespan != rules->baseLifespan ||
+	   gameOptions.fixedPoint != rules->fixedPoint ||
+	   gameOptions.fieldTheta != rules->fieldTheta)) {
+		*error = "other options";
+		return false;
+	}
+	
+	simulateEffects = false;
+	set_level(levelCache[level].blocks, levelCache[level].count);
+	match_init();
+	
+	base_t *player = &leftBase;
+	while(p < end)
+	{
+		uint16_t size;
+		turn_t turn;
+		if((end - p) < 2) {
+			*error = "truncated turn";
+			return false;
+		}
+		p = get_u16(p, &size);
+		if((end - p) < size || turn_decode(p, size, &turn) == false) {
+			*error = "malformed turn";
+			return false;
+		}
+		p += size;
+		uint8_t const *hashes;
+		int ticks;
+		if((p = replay_battle_decode(p, end, &hashes, &ticks)) == NULL) {
+			*error = "truncated battle";
+			return false;
+		}
+		
+		turn_begin(player);
+		if(turn.hash != state_hash() && result->desyncTurn < 0) {
+			result->desyncTurn = result->turns;
+		}
+		if(turn_legal(player, &turn) == false) {
+			*error = "illegal turn";
+			battle_reset();
+			return false;
+		}
+		launch_projectile(player, apply_turn(player, &turn));
+		result->turns += 1;
+		
+		int state;
+		int tick = 0;
+		do {
+			state = battle_tick(SIM_DT);
+			if(hashes != NULL && result->desyncTurn < 0 && replay_tick_differs(hashes, ticks, tick)) {
+				result->desyncTurn = result->turns - 1;
+				result->desyncTick = tick;
+			}
+			tick++;
+		} while(state == BATTLE_RUNNING);
+		if(hashes != NULL && result->desyncTurn < 0 && tick < ticks) {
+			// the recorded battle went on
+			result->desyncTurn = result->turns - 1;
+			result->desyncTick = tick;
+		}
+		
+		if(state == BATTLE_LEFT_DESTROYED) {
+			result->winner = 2;
+			break;
+		}
+		if(state == BATTLE_RIGHT_DESTROYED) {
+			result->winner = 1;
+			break;
+		}
+		player = (player == &leftBase) ? &rightBase : &leftBase;
+	}
+	
+	base_t const *bases[] = { &leftBase, &rightBase };
+	for(int i = 0; i < 2; i++) {
+		result->lifepoints[i] = bases[i]->lifepoints;
+		for(int j = 0; j < 24; j++) {
+			result->protectors[i][j] = bases[i]->protectors[j];
+		}
+	}
+	battle_reset();
+	return true;
+}
+
+/**
+ * Replay round trip test (--replay-test).
+ * Plays bot matches on level 1 like start_round() does, but every build
+ * phase first places two affectors, takes the first one back and undoes
+ * and redoes that, like a player changing their mind. The replay of the
+ * match is checked with replay_verify(), which must come to the same
+ * winner without a desync. Runs both simulations, with and without
+ * affectorsStay.
+ **/
+#define REPLAY_TEST_TURNS 40
+
+static affector_handle_t replay_test_place(base_t *player, float2 pos)
+{
+	for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
+		if(player->resources[i] <= 0) {
+			continue;
+		}
+		affector_t *a = create_affector(player, i, pos);
+		if(a == NULL) {
+			break;
+		}
+		player->resources[i] -= 1;
+		affector_handle_t handle = affector_handle(a);
+		build_record(handle, (build_state_t){ false }, build_state(a));
+		return handle;
+	}
+	return AFFECTOR_NONE;
+}
+
+static void replay_test_build(base_t *player, float *angle)
+{
+	affector_handle_t first = replay_test_place(player, (float2){ 300, 200 });
+	replay_test_place(player, (float2){ 700, 500 });
+	
+	affector_t *a = affector_get(first);
+	if(a != NULL) {
+		build_state_t before = build_state(a);
+		player->resources[a->type] += 1;
+		affector_remove(a);
+		build_record(first, before, (build_state_t){ false });
+		build_undo(player);
+		build_redo(player);
+	}
+	bot_build(player, angle);
+}
+
+/**
+ * Plays and verifies one match, returns false if it failed.
+ **/
+static bool replay_test_match(bool fixedPoint, bool affectorsStay)
+{
+	gameOptions.fixedPoint = fixedPoint;
+	gameOptions.affectorsStay = affectorsStay;
+	fprintf(stdout, "%-5s %-14s", fixedPoint ? "fixed" : "float", affectorsStay ? "affectorsStay" : "");
+	
+	replayOutput = tmpfile();
+	if(replayOutput == NULL) {
+		fprintf(stdout, " FAILED: no temporary file\n");
+		return false;
+	}
+	simulateEffects = false;
+	set_level(levelCache[1].blocks, levelCache[1].count);
+	matchSeed = 1;
+	match_init();
+	replay_start(1);
+	
+	int winner = 0;
+	int turns = 0;
+	base_t *player = &leftBase;
+	while(turns < REPLAY_TEST_TURNS && winner == 0)
+	{
+		turn_begin(player);
+		build_history_clear();
+		uint32_t hash = state_hash();
+		float angle;
+		replay_test_build(player, &angle);
+		
+		turn_t t;
+		capture_turn(player, angle, &t);
+		t.hash = hash;
+		angle = apply_turn(player, &t);
+		replay_turn(&t);
+		launch_projectile(player, angle);
+		turns++;
+		
+		int state;
+		do {
+			state = battle_tick(SIM_DT);
+			replay_tick();
+		} while(state == BATTLE_RUNNING);
+		replay_battle();
+		
+		if(state == BATTLE_LEFT_DESTROYED) {
+			winner = 2;
+		}
+		if(state == BATTLE_RIGHT_DESTROYED) {
+			winner = 1;
+		}
+		player = (player == &leftBase) ? &rightBase : &leftBase;
+	}
+	battle_reset();
+	
+	long len = ftell(replayOutput);
+	uint8_t *data = malloc(len);
+	rewind(replayOutput);
+	bool read = (data != NULL && fread(data, 1, len, replayOutput) == (size_t)len);
+	fclose(replayOutput);
+	replayOutput = NULL;
+	if(read == false) {
+		fprintf(stdout, " FAILED: can't read the replay back\n");
+		free(data);
+		return false;
+	}
+	
+	replay_result_t result;
+	const char *error;
+	bool ok = replay_verify(data, len, NULL, &result, &error);
+	free(data);
+	fprintf(stdout, " %2d turns:", turns);
+	if(ok == false) {
+		fprintf(stdout, " FAILED: %s\n", error);
+		return false;
+	}
+	if(result.desyncTurn >= 0) {
+		fprintf(stdout, " FAILED: desync in turn %d, tick %d\n", result.desyncTurn, result.desyncTick);
+		return false;
+	}
+	if(result.turns != turns || result.winner != winner) {
+		fprintf(stdout, " FAILED: %d turns and winner %d, replayed %d turns and winner %d\n",
+			turns, winner, result.turns, result.winner);
+		return false;
+	}
+	fprintf(stdout, " ok\n");
+	return true;
+}
+
+int replay_test()
+{
+	if(levels_preload() == 0 || levelCache[1].count < 0) {
+		fprintf(stderr, "No levels found.\n");
+		return 1;
+	}
+	int failed = 0;
+	for(int i = 0; i < 4; i++) {
+		if(replay_test_match(i & 1, i & 2) == false) {
+			failed++;
+		}
+	}
+	return failed > 0 ? 1 : 0;
+}
+
+/**
+ * Level balance analysis (--analyze-levels).
+ * Every level is played with a single shot from each base for every
+ * launch angle of player_aim(), optionally against affectors from setup
+ * files. Each shot starts from a new match at battleTime 0 with the
+ * options of game.ini and is classified by the most important thing it
+ * did, in the order of the ANALYSIS_* outcomes. The sweeps are split into
+ * chunks of ANALYSIS_CHUNK angles which the workers take from a counter.
+ **/
+#define ANALYSIS_BASE          0 // hit the enemy base
+#define ANALYSIS_SELF          1 // hit the own base
+#define ANALYSIS_BARRICADE     2 // damaged an enemy barricade
+#define ANALYSIS_OWN_BARRICADE 3
+#define ANALYSIS_WALL          4
+#define ANALYSIS_MISS          5 // left the screen or fizzled out
+#define ANALYSIS_OUTCOMES      6
+
+#define ANALYSIS_CHUNK          64
+#define ANALYSIS_MAX_AFFECTORS  AFFECTOR_MAX
+#define ANALYSIS_BAND_HEIGHT    24
+
+static const char *analysisNames[ANALYSIS_OUTCOMES] = {
+	"base", "self", "barricade", "own_barricade", "wall", "miss"
+};
+
+static const uint32_t analysisColors[ANALYSIS_OUTCOMES] = {
+	0xFF40C040, 0xFFE03030, 0xFFF0A020, 0xFFA050D0, 0xFF808080, 0xFF202040
+};
+
+/**
+ * Affectors placed for the shooting base. Positions and rotations are
+ * given for the left base and mirrored for the right one.
+ **/
+typedef struct {
+	const char *name;
+	int count;
+	struct {
+		int type;
+		float2 pos;
+		float rotation;
+	} affectors[ANALYSIS_MAX_AFFECTORS];
+} analysis_setup_t;
+
+struct {
+	uint8_t options[OPTIONS_SIZE];
+	int levels[LEVEL_MAX_COUNT];
+	int levelCount;
+	analysis_setup_t setups[ANALYSIS_MAX_SETUPS];
+	int setupCount;
+	float step;
+	int angles;
+	int chunks;        // per sweep
+	uint8_t *outcomes; // [level][setup][base][angle]
+	SDL_atomic_t next;
+} analysis;
+
+/**
+ * Reads a setup file: "type,x,y,rotation" per affector.
+ **/
+static bool analysis_load_setup(const char *file, analysis_setup_t *setup)
+{
+	FILE *f = fopen(file, "r");
+	if(f == NULL) {
+		return false;
+	}
+	fscanf(f, "iAIM Setup 1.0\n");
+	
+	setup->name = file;
+	setup->count = 0;
+	int type;
+	float x, y, rotation;
+	while(setup->count < ANALYSIS_MAX_AFFECTORS && fscanf(f, "%d,%f,%f,%f", &type, &x, &y, &rotation) == 4)
+	{
+		if(type < 0 || type >= AFFECTOR_TYPE_COUNT) {
+			LOG_WARN("Unknown affector type %d in %s", type, file);
+			continue;
+		}
+		setup->affectors[setup->count].type = type;
+		setup->affectors[setup->count].pos = (float2){ x, y };
+		setup->affectors[setup->count].rotation = rotation;
+		setup->count++;
+	}
+	bool ok = (ferror(f) == 0);
+	fclose(f);
+	return ok;
+}
+
+static int analyze_shot(analysis_setup_t const *setup, base_t *player, float angle)
+{
+	base_t *enemy = (player == &leftBase) ? &rightBase : &leftBase;
+	
+	match_init();
+	battle_reset();
+	battleStartMs = 0;
+	for(int i = 0; i < setup->count; i++) {
+		float2 pos = setup->affectors[i].pos;
+		float rotation = setup->affectors[i].rotation;
+		if(player == &rightBase) {
+			pos.x = battleground.w - pos.x;
+			rotation = 180 - rotation;
+		}
+		affector_t *a = create_affector(player, setup->affectors[i].type, pos);
+		if(a == NULL) {
+			break;
+		}
+		a->rotation = rotation;
+	}
+	
+	launch_projectile(player, angle);
+	int state;
+	do {
+		state = battle_tick(SIM_DT);
+	} while(state == BATTLE_RUNNING);
+	
+	if(enemy->lifepoints < BASE_LIFEPOINTS) {
+		return ANALYSIS_BASE;
+	}
+	if(player->lifepoints < BASE_LIFEPOINTS) {
+		return ANALYSIS_SELF;
+	}
+	int outcome = (battleWallHits > 0) ? ANALYSIS_WALL : ANALYSIS_MISS;
+	for(int i = 0; i < 24; i++) {
+		if(enemy->protectors[i] < PROTECTOR_LIFE) {
+			return ANALYSIS_BARRICADE;
+		}
+		if(player->protectors[i] < PROTECTOR_LIFE) {
+			outcome = ANALYSIS_OWN_BARRICADE;
+		}
+	}
+	return outcome;
+}
+
+static int analysis_worker(void *arg)
+{
+	int level;
+	// the options of game.ini, gameOptions is thread local
+	options_decode(analysis.options, &level);
+	simulateEffects = false;
+	
+	int jobs = analysis.levelCount * analysis.setupCount * 2 * analysis.chunks;
+	while(true)
+	{
+		int job = SDL_AtomicAdd(&analysis.next, 1);
+		if(job >= jobs) {
+			break;
+		}
+		int sweep = job / analysis.chunks;
+		int first = (job % analysis.chunks) * ANALYSIS_CHUNK;
+		int last = MIN(first + ANALYSIS_CHUNK, analysis.angles);
+		
+		level = analysis.levels[sweep / (analysis.setupCount * 2)];
+		analysis_setup_t const *setup = &analysis.setups[(sweep / 2) % analysis.setupCount];
+		base_t *player = (sweep % 2 == 0) ? &leftBase : &rightBase;
+		
+		set_level(levelCache[level].blocks, levelCache[level].count);
+		for(int i = first; i < last; i++) {
+			analysis.outcomes[sweep * analysis.angles + i] = analyze_shot(setup, player, 15.0 + i * analysis.step);
+		}
+	}
+	return 0;
+}
+
+static bool analysis_write_image(const char *file, int levelIndex)
+{
+	int bands = analysis.setupCount * 2;
+	SDL_Surface *image = SDL_CreateRGBSurfaceWithFormat(
+		0,
+		analysis.angles, bands * ANALYSIS_BAND_HEIGHT,
+		32, SDL_PIXELFORMAT_ARGB8888);
+	if(image == NULL) {
+		return false;
+	}
+	for(int band = 0; band < bands; band++) {
+		uint8_t const *outcomes = &analysis.outcomes[(levelIndex * bands + band) * analysis.angles];
+		for(int y = 0; y < ANALYSIS_BAND_HEIGHT; y++) {
+			uint32_t *row = (uint32_t*)((uint8_t*)image->pixels + (band * ANALYSIS_BAND_HEIGHT + y) * image->pitch);
+			for(int x = 0; x < analysis.angles; x++) {
+				// a dark line between the bands
+				row[x] = (y == 0 && band > 0) ? 0xFF000000 : analysisColors[outcomes[x]];
+			}
+		}
+	}
+	bool ok = (IMG_SavePNG(image, file) == 0);
+	SDL_FreeSurface(image);
+	return ok;
+}
+
+/**
+ * Writes shots.csv (every shot), summary.csv (per level, setup and base)
+ * and level_NN.png (one band per setup and base, one column per angle)
+ * into dir.
+ **/
+static bool analysis_write(const char *dir)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/shots.csv", dir);
+	FILE *shots = fopen(path, "w");
+	snprintf(path, sizeof(path), "%s/summary.csv", dir);
+	FILE *summary = fopen(path, "w");
+	if(shots == NULL || summary == NULL) {
+		fprintf(stderr, "Failed to write into %s\n", dir);
+		if(shots != NULL) fclose(shots);
+		if(summary != NULL) fclose(summary);
+		return false;
+	}
+	
+	const char *baseNames[] = { "left", "right" };
+	fprintf(shots, "level,setup,base,angle,outcome\n");
+	fprintf(summary, "level,setup,base,shots");
+	for(int o = 0; o < ANALYSIS_OUTCOMES; o++) {
+		fprintf(summary, ",%s", analysisNames[o]);
+	}
+	fprintf(summary, ",base_windows,widest_window\n");
+	
+	bool ok = true;
+	for(int l = 0; l < analysis.levelCount; l++) {
+		int level = analysis.levels[l];
+		for(int s = 0; s < analysis.setupCount; s++) {
+			float baseShare[2];
+			for(int b = 0; b < 2; b++) {
+				int sweep = (l * analysis.setupCount + s) * 2 + b;
+				uint8_t const *outcomes = &analysis.outcomes[sweep * analysis.angles];
+				const char *setup = analysis.setups[s].name;
+				
+				int counts[ANALYSIS_OUTCOMES] = { 0 };
+				int windows = 0, run = 0, widest = 0;
+				for(int i = 0; i < analysis.angles; i++) {
+					fprintf(shots, "%d,%s,%s,%.2f,%s\n",
+						level, setup, baseNames[b], 15.0 + i * analysis.step,
+						analysisNames[outcomes[i]]);
+					counts[outcomes[i]]++;
+					if(outcomes[i] == ANALYSIS_BASE) {
+						if(run == 0) {
+							windows++;
+						}
+						run++;
+						widest = MAX(widest, run);
+					} else {
+						run = 0;
+					}
+				}
+				
+				fprintf(summary, "%d,%s,%s,%d", level, setup, baseNames[b], analysis.angles);
+				for(int o = 0; o < ANALYSIS_OUTCOMES; o++) {
+					fprintf(summary, ",%.4f", (float)counts[o] / analysis.angles);
+				}
+				fprintf(summary, ",%d,%.2f\n", windows, widest * analysis.step);
+				baseShare[b] = 100.0 * counts[ANALYSIS_BASE] / analysis.angles;
+			}
+			fprintf(stdout, "Level %02d, setup %s: left hits the base with %.1f%%, right with %.1f%% of the angles\n",
+				level, analysis.setups[s].name, baseShare[0], baseShare[1]);
+		}
+		
+		snprintf(path, sizeof(path), "%s/level_%02d.png", dir, level);
+		if(analysis_write_image(path, l) == false) {
+			fprintf(stderr, "Failed to write %s: %s\n", path, SDL_GetError());
+			ok = false;
+		}
+	}
+	fclose(shots);
+	fclose(summary);
+	return ok;
+}
+
+int analyze_levels(const char *dir, float step, int setupCount, char **setupFiles, int workers)
+{
+	if(levels_preload() == 0) {
+		fprintf(stderr, "No levels found.\n");
+		return 1;
+	}
+	if(step <= 0) {
+		fprintf(stderr, "Invalid angle step %f\n", step);
+		return 1;
+	}
+	if(workers <= 0) {
+		workers = SDL_GetCPUCount();
+	}
+	
+	for(int i = 1; i <= LEVEL_MAX_COUNT; i++) {
+		if(levelCache[i].count >= 0) {
+			analysis.levels[analysis.levelCount++] = i;
+		}
+	}
+	if(setupCount == 0) {
+		analysis.setups[0].name = "none";
+		analysis.setupCount = 1;
+	}
+	for(int i = 0; i < setupCount; i++) {
+		if(analysis_load_setup(setupFiles[i], &analysis.setups[analysis.setupCount++]) == false) {
+			fprintf(stderr, "Failed to load setup %s\n", setupFiles[i]);
+			return 1;
+		}
+	}
+	options_encode(analysis.options, 0);
+	analysis.step = step;
+	analysis.angles = (int)(150.0 / step + 0.001) + 1;
+	analysis.chunks = (analysis.angles + ANALYSIS_CHUNK - 1) / ANALYSIS_CHUNK;
+	int total = analysis.levelCount * analysis.setupCount * 2 * analysis.angles;
+	analysis.outcomes = malloc(total);
+	if(analysis.outcomes == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	
+	uint64_t start = SDL_GetPerformanceCounter();
+	SDL_Thread *threads[64];
+	workers = MIN(workers, 64);
+	for(int i = 0; i < workers; i++) {
+		threads[i] = SDL_CreateThread(analysis_worker, "analysis", NULL);
+		if(threads[i] == NULL) {
+			LOG_WARN("Failed to start an analysis worker: %s", SDL_GetError());
+			workers = i;
+			break;
+		}
+	}
+	if(workers == 0) {
+		analysis_worker(NULL);
+	}
+	for(int i = 0; i < workers; i++) {
+		SDL_WaitThread(threads[i], NULL);
+	}
+	double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+	fprintf(stdout, "Simulated %d shots on %d levels in %.2f s with %d workers.\n",
+		total, analysis.levelCount, seconds, workers);
+	
+	bool ok = analysis_write(dir);
+	free(analysis.outcomes);
+	return ok ? 0 : 1;
+}
+
+/**
+ * Level generator (--generate-levels).
+ * Every candidate is a random block layout, made from its own random
+ * stream so the result only depends on the seed. A candidate has to keep
+ * GENERATOR_BASE_CLEARANCE pixels away from both bases, may not overlap
+ * itself and must cover GENERATOR_MIN_COVERAGE to GENERATOR_MAX_COVERAGE
+ * of the battleground. It is then scored with the shots of the level
+ * analysis (every GENERATOR_STEP degrees from both bases, for every
+ * setup): both bases should threaten the other one (hit the base or a
+ * barricade) about equally often, rarely hit themselves and see a lot
+ * of different outcomes while sweeping the angle.
+ **/
+#define GENERATOR_MAX_BLOCKS      16
+#define GENERATOR_BASE_CLEARANCE  190
+#define GENERATOR_MIN_COVERAGE    0.03
+#define GENERATOR_MAX_COVERAGE    0.15
+#define GENERATOR_MIN_SIZE        24
+#define GENERATOR_MAX_SIZE        160
+#define GENERATOR_ATTEMPTS        100
+#define GENERATOR_STEP            1.0
+#define GENERATOR_MIN_THREAT      0.05
+#define GENERATOR_MAX_THREAT      0.5
+#define GENERATOR_CHANGES         20 // outcome changes per sweep for a full score
+#define GENERATOR_MIN_SCORE       0.3
+
+typedef struct {
+	SDL_Rect blocks[GENERATOR_MAX_BLOCKS];
+	int count;
+	float score;
+	float threat[2];
+	float self[2];
+	int index;
+} generator_candidate_t;
+
+struct {
+	uint8_t options[OPTIONS_SIZE];
+	analysis_setup_t setups[ANALYSIS_MAX_SETUPS];
+	int setupCount;
+	uint32_t seed;
+	int symmetry;
+	generator_candidate_t *candidates;
+	int count;
+	SDL_atomic_t next;
+} generator;
+
+static bool generator_fits(SDL_Rect const *blocks, int count, SDL_Rect r)
+{
+	if(r.x < 0 || r.y < 0 || (r.x + r.w) > battleground.w || (r.y + r.h) > battleground.h) {
+		return false;
+	}
+	float bases[2] = { 0, battleground.w };
+	for(int i = 0; i < 2; i++) {
+		float dx = MAX(r.x - bases[i], MAX(0, bases[i] - (r.x + r.w)));
+		float dy = MAX(r.y - battleground.h / 2, MAX(0, battleground.h / 2 - (r.y + r.h)));
+		if((dx*dx + dy*dy) < GENERATOR_BASE_CLEARANCE * GENERATOR_BASE_CLEARANCE) {
+			return false;
+		}
+	}
+	for(int i = 0; i < count; i++) {
+		SDL_Rect b = blocks[i];
+		if(r.x < (b.x + b.w) && b.x < (r.x + r.w) && r.y < (b.y + b.h) && b.y < (r.y + r.h)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Adds r and its mirrored copies. A block crossing a mirror axis is
+ * centered on it instead of being copied.
+ **/
+static bool generator_place(generator_candidate_t *c, SDL_Rect r)
+{
+	SDL_Rect copies[4];
+	int n = 0;
+	bool mirrorX = (generator.symmetry != SYMMETRY_NONE);
+	bool mirrorY = (generator.symmetry == SYMMETRY_BOTH);
+	if(mirrorX && (r.x + r.w) > battleground.w / 2) {
+		r.x = (battleground.w - r.w) / 2;
+		mirrorX = false;
+	}
+	if(mirrorY && (r.y + r.h) > battleground.h / 2) {
+		r.y = (battleground.h - r.h) / 2;
+		mirrorY = false;
+	}
+	copies[n++] = r;
+	if(mirrorX) {
+		copies[n++] = (SDL_Rect){ battleground.w - r.x - r.w, r.y, r.w, r.h };
+	}
+	if(mirrorY) {
+		for(int i = n - 1; i >= 0; i--) {
+			copies[n++] = (SDL_Rect){ copies[i].x, battleground.h - copies[i].y - copies[i].h, r.w, r.h };
+		}
+	}
+	
+	if((c->count + n) > GENERATOR_MAX_BLOCKS) {
+		return false;
+	}
+	for(int i = 0; i < n; i++) {
+		if(generator_fits(c->blocks, c->count + i, copies[i]) == false) {
+			return false;
+		}
+		c->blocks[c->count + i] = copies[i];
+	}
+	c->count += n;
+	return true;
+}
+
+static bool generator_layout(generator_candidate_t *c, rng_t *rng)
+{
+	float total = battleground.w * battleground.h;
+	float coverage = 0;
+	float target = GENERATOR_MIN_COVERAGE + (GENERATOR_MAX_COVERAGE - GENERATOR_MIN_COVERAGE) * rng_range(rng, 1000) / 1000.0;
+	
+	c->count = 0;
+	for(int attempt = 0; attempt < GENERATOR_ATTEMPTS && coverage < target; attempt++)
+	{
+		SDL_Rect r;
+		r.w = 2 * ((GENERATOR_MIN_SIZE + rng_range(rng, GENERATOR_MAX_SIZE - GENERATOR_MIN_SIZE)) / 2);
+		r.h = 2 * ((GENERATOR_MIN_SIZE + rng_range(rng, GENERATOR_MAX_SIZE - GENERATOR_MIN_SIZE)) / 2);
+		r.x = rng_range(rng, battleground.w - r.w);
+		r.y = rng_range(rng, battleground.h - r.h);
+		
+		int before = c->count;
+		if(generator_place(c, r) == false) {
+			continue;
+		}
+		for(int i = before; i < c->count; i++) {
+			coverage += c->blocks[i].w * c->blocks[i].h / total;
+		}
+		if(coverage > GENERATOR_MAX_COVERAGE) {
+			// too much, drop the last block again
+			for(int i = before; i < c->count; i++) {
+				coverage -= c->blocks[i].w * c->blocks[i].h / total;
+			}
+			c->count = before;
+		}
+	}
+	return coverage >= GENERATOR_MIN_COVERAGE;
+}
+
+static void generator_score(generator_candidate_t *c)
+{
+	int angles = (int)(150.0 / GENERATOR_STEP) + 1;
+	int counts[2][ANALYSIS_OUTCOMES] = { { 0 } };
+	int changes = 0;
+	
+	set_level(c->blocks, c->count);
+	for(int s = 0; s < generator.setupCount; s++) {
+		for(int b = 0; b < 2; b++) {
+			base_t *player = (b == 0) ? &leftBase : &rightBase;
+			int last = -1;
+			for(int i = 0; i < angles; i++) {
+				int outcome = analyze_shot(&generator.setups[s], player, 15.0 + i * GENERATOR_STEP);
+				counts[b][outcome]++;
+				if(last >= 0 && outcome != last) {
+					changes++;
+				}
+				last = outcome;
+			}
+		}
+	}
+	
+	int shots = generator.setupCount * angles;
+	for(int b = 0; b < 2; b++) {
+		c->threat[b] = (float)(counts[b][ANALYSIS_BASE] + counts[b][ANALYSIS_BARRICADE]) / shots;
+		c->self[b] = (float)(counts[b][ANALYSIS_SELF] + counts[b][ANALYSIS_OWN_BARRICADE]) / shots;
+	}
+	
+	float threat = (c->threat[0] + c->threat[1]) / 2;
+	if(threat < GENERATOR_MIN_THREAT || threat > GENERATOR_MAX_THREAT) {
+		c->score = 0;
+		return;
+	}
+	float imbalance = fabsf(c->threat[0] - c->threat[1]) + fabsf(c->self[0] - c->self[1]);
+	float variety = MIN(1.0, (float)changes / (2 * generator.setupCount * GENERATOR_CHANGES));
+	float self = (c->self[0] + c->self[1]) / 2;
+	c->score = MAX(0, 1 - 4 * imbalance) * variety * (1 - self);
+}
+
+static int generator_worker(void *arg)
+{
+	int level;
+	options_decode(generator.options, &level);
+	simulateEffects = false;
+	
+	while(true)
+	{
+		int index = SDL_AtomicAdd(&generator.next, 1);
+		if(index >= generator.count) {
+			break;
+		}
+		generator_candidate_t *c = &generator.candidates[index];
+		c->index = index;
+		rng_t rng;
+		rng_seed(&rng, generator.seed, index);
+		if(generator_layout(c, &rng)) {
+			generator_score(c);
+		} else {
+			c->score = -1;
+		}
+	}
+	return 0;
+}
+
+static int compare_candidates(const void *a, const void *b)
+{
+	generator_candidate_t const *x = a;
+	generator_candidate_t const *y = b;
+	if(x->score != y->score) {
+		return (x->score < y->score) ? 1 : -1;
+	}
+	return x->index - y->index;
+}
+
+/**
+ * Writes a preview like the ones in levels/: the battleground scaled
+ * down to LEVEL_PREVIEW_W x LEVEL_PREVIEW_H.
+ **/
+#define LEVEL_PREVIEW_W 420
+#define LEVEL_PREVIEW_H 295
+
+static bool generator_write_preview(const char *file, generator_candidate_t const *c)
+{
+	SDL_Surface *image = SDL_CreateRGBSurfaceWithFormat(0, LEVEL_PREVIEW_W, LEVEL_PREVIEW_H, 32, SDL_PIXELFORMAT_ARGB8888);
+	if(image == NULL) {
+		return false;
+	}
+	for(int y = 0; y < LEVEL_PREVIEW_H; y++) {
+		uint32_t *row = (uint32_t*)((uint8_t*)image->pixels + y * image->pitch);
+		for(int x = 0; x < LEVEL_PREVIEW_W; x++) {
+			int bx = x * battleground.w / LEVEL_PREVIEW_W;
+			int by = y * battleground.h / LEVEL_PREVIEW_H;
+			uint32_t color = 0xFF101830;
+			for(int i = 0; i < 2; i++) {
+				int dx = bx - i * battleground.w;
+				int dy = by - battleground.h / 2;
+				if((dx*dx + dy*dy) < 126 * 126) {
+					color = (i == 0) ? 0xFF5C4BFF : 0xFF55B64A;
+				}
+			}
+			for(int i = 0; i < c->count; i++) {
+				SDL_Rect r = c->blocks[i];
+				if(bx >= r.x && bx < (r.x + r.w) && by >= r.y && by < (r.y + r.h)) {
+					color = 0xFFB0B0B0;
+				}
+			}
+			row[x] = color;
+		}
+	}
+	bool ok = (IMG_SavePNG(image, file) == 0);
+	SDL_FreeSurface(image);
+	return ok;
+}
+
+int generate_levels(const char *dir, int keep, int count, uint32_t seed, int symmetry, int setupCount, char **setupFiles, int workers)
+{
+	if(count <= 0 || keep <= 0) {
+		fprintf(stderr, "Nothing to generate.\n");
+		return 1;
+	}
+	if(workers <= 0) {
+		workers = SDL_GetCPUCount();
+	}
+	if(setupCount == 0) {
+		generator.setups[0].name = "none";
+		generator.setupCount = 1;
+	}
+	for(int i = 0; i < setupCount; i++) {
+		if(analysis_load_setup(setupFiles[i], &generator.setups[generator.setupCount++]) == false) {
+			fprintf(stderr, "Failed to load setup %s\n", setupFiles[i]);
+			return 1;
+		}
+	}
+	options_encode(generator.options, 0);
+	generator.seed = seed;
+	generator.symmetry = symmetry;
+	generator.count = count;
+	generator.candidates = calloc(count, sizeof(generator_candidate_t));
+	if(generator.candidates == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	
+	uint64_t start = SDL_GetPerformanceCounter();
+	SDL_Thread *threads[64];
+	workers = MIN(workers, 64);
+	for(int i = 0; i < workers; i++) {
+		threads[i] = SDL_CreateThread(generator_worker, "generator", NULL);
+		if(threads[i] == NULL) {
+			LOG_WARN("Failed to start a generator worker: %s", SDL_GetError());
+			workers = i;
+			break;
+		}
+	}
+	if(workers == 0) {
+		generator_worker(NULL);
+	}
+	for(int i = 0; i < workers; i++) {
+		SDL_WaitThread(threads[i], NULL);
+	}
+	double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+	fprintf(stdout, "Scored %d candidates (seed %u) in %.2f s with %d workers.\n", count, seed, seconds, workers);
+	
+	qsort(generator.candidates, count, sizeof(generator_candidate_t), compare_candidates);
+	
+	int written = 0;
+	for(int i = 0; i < count && written < keep; i++) {
+		generator_candidate_t const *c = &generator.candidates[i];
+		if(c->score < GENERATOR_MIN_SCORE) {
+			break;
+		}
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%02d.txt", dir, written + 1);
+		FILE *f = fopen(path, "w");
+		if(f == NULL) {
+			fprintf(stderr, "Failed to write %s\n", path);
+			break;
+		}
+		fprintf(f, "iAIM Level 1.0\n");
+		for(int j = 0; j < c->count; j++) {
+			fprintf(f, "%d,%d,%d,%d\n", c->blocks[j].x, c->blocks[j].y, c->blocks[j].w, c->blocks[j].h);
+		}
+		fclose(f);
+		
+		snprintf(path, sizeof(path), "%s/%02d.png", dir, written + 1);
+		if(generator_write_preview(path, c) == false) {
+			fprintf(stderr, "Failed to write %s: %s\n", path, SDL_GetError());
+		}
+		fprintf(stdout, "%02d.txt: score %.3f, %d blocks, threat %.1f%% / %.1f%%, self %.1f%% / %.1f%%\n",
+			written + 1, c->score, c->count,
+			100 * c->threat[0], 100 * c->threat[1],
+			100 * c->self[0], 100 * c->self[1]);
+		written++;
+	}
+	if(written == 0) {
+		fprintf(stdout, "No candidate scored %.2f or more.\n", GENERATOR_MIN_SCORE);
+	}
+	free(generator.candidates);
+	return 0;
+}
+
+/**
+ * Creates a software renderer drawing into a 1280x720 surface on SDL's
+ * dummy drivers, so nothing needs a display or a graphics card, and loads
+ * the resources. Returns the surface or NULL.
+ **/
+SDL_Surface *headless_init()
+{
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+	SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+	SDL_SetHint(SDL_HINT_RENDER_BATCHING, "0");
+	if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
+		fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
+		return NULL;
+	}
+	atexit(SDL_Quit);
+	if(IMG_Init(IMG_INIT_PNG) < 0 || Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 1024) == -1) {
+		fprintf(stderr, "Failed to initialize IMG or MIX.\n");
+		return NULL;
+	}
+	
+	SDL_Surface *frame = SDL_CreateRGBSurfaceWithFormat(0, 1280, 720, 32, SDL_PIXELFORMAT_ARGB8888);
+	if(frame == NULL || (renderer = SDL_CreateSoftwareRenderer(frame)) == NULL) {
+		fprintf(stderr, "Failed to create the software renderer: %s\n", SDL_GetError());
+		return NULL;
+	}
+	load_resources();
+	return frame;
+}
+
+/**
+ * Render test (--render-test).
+ * Draws scripted frames with the software renderer into a surface on
+ * SDL's dummy video driver, so it runs without a display or a GPU. Every
+ * frame is drawn RENDER_TEST_REPEATS times for the timings and then
+ * compared with the golden image DIR/<name>.png: a pixel differs if one
+ * of its channels is more than RENDER_TEST_TOLERANCE off, and a frame
+ * fails if more than RENDER_TEST_MAX_DIFF of its pixels differ. A failed
+ * frame is written next to its golden image as <name>-actual.png, a
+ * missing golden image fails too. With update the golden images are
+ * written instead of compared.
+ **/
+#define RENDER_TEST_REPEATS   20
+#define RENDER_TEST_TOLERANCE 8
+#define RENDER_TEST_MAX_DIFF  0.001
+
+static const char *renderPassNames[RENDER_PASS_COUNT] = {
+	"other", "background", "bases", "blocks", "protectors",
+	"trails", "projectiles", "affectors", "panels"
+};
+
+static affector_t *renderTestSelection = NULL;
+
+static void render_test_match(const char *level)
+{
+	load_level(level);
+	match_init();
+	battle_reset();
+	battleStartMs = 0;
+	battleTime = 12.5;
+	renderAlpha = 1.0;
+	renderTestSelection = NULL;
+}
+
+static void render_test_setup_build()
+{
+	render_test_match("levels/01.txt");
+	int resources[AFFECTOR_TYPE_COUNT] = { 2, 1, 0, 1, 3 };
+	memcpy(leftBase.resources, resources, sizeof(resources));
+	
+	create_affector(&leftBase, 0, (float2){ 300, 200 });
+	renderTestSelection = create_affector(&leftBase, 2, (float2){ 420, 520 });
+	renderTestSelection->rotation = 30;
+	affector_t *a = create_affector(&rightBase, 1, (float2){ 700, 360 });
+	a->rotation = 180;
+}
+
+static void render_test_setup_battle()
+{
+	render_test_match("levels/02.txt");
+	leftBase.lifepoints = 2;
+	rightBase.protectors[3] = 1;
+	rightBase.protectors[4] = 2;
+	
+	create_affector(&leftBase, 0, (float2){ 380, 520 });
+	affector_t *a = create_affector(&leftBase, 3, (float2){ 300, 230 });
+	a->rotation = -20;
+	launch_projectile(&leftBase, 60);
+	for(int i = 0; i < 90; i++) {
+		battle_tick(SIM_DT);
+	}
+	renderAlpha = 0.5;
+}
+
+static void render_test_draw_menu()
+{
+	render_menu(1);
+}
+
+static void render_test_draw_levels()
+{
+	render_level_selection(2);
+}
+
+static void render_test_draw_build()
+{
+	SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
+	SDL_RenderClear(renderer);
+	render_battleground();
+	render_tool_panels(&leftBase);
+	render_selection(renderTestSelection, false);
+}
+
+static void render_test_draw_aim()
+{
+	SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+	SDL_RenderClear(renderer);
+	render_battleground();
+	render_aim_preview(&rightBase, 60);
+	render_tool_panels(NULL);
+}
+
+static void render_test_draw_battle()
+{
+	SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+	SDL_RenderClear(renderer);
+	render_battleground();
+	render_tool_panels(NULL);
+}
+
+static struct {
+	const char *name;
+	void (*setup)();
+	void (*draw)();
+} renderTestFrames[] = {
+	{ "menu",   NULL,                       render_test_draw_menu },
+	{ "levels", NULL,                       render_test_draw_levels },
+	{ "build",  render_test_setup_build,    render_test_draw_build },
+	{ "aim",    render_test_setup_build,    render_test_draw_aim },
+	{ "battle", render_test_setup_battle,   render_test_draw_battle },
+};
+
+/**
+ * Returns the share of pixels that differ, or -1 if the sizes don't match.
+ **/
+static float render_test_compare(SDL_Surface *frame, SDL_Surface *golden)
+{
+	if(frame->w != golden->w || frame->h != golden->h) {
+		return -1;
+	}
+	int differ = 0;
+	for(int y = 0; y < frame->h; y++) {
+		uint8_t const *a = (uint8_t const*)frame->pixels + y * frame->pitch;
+		uint8_t const *b = (uint8_t const*)golden->pixels + y * golden->pitch;
+		for(int x = 0; x < 4 * frame->w; x += 4) {
+			for(int c = 0; c < 3; c++) {
+				if(abs(a[x + c] - b[x + c]) > RENDER_TEST_TOLERANCE) {
+					differ++;
+					break;
+				}
+			}
+		}
+	}
+	return (float)differ / (frame->w * frame->h);
+}
+
+int render_test(const char *dir, bool update)
+{
+	SDL_Surface *frame = headless_init();
+	if(frame == NULL) {
+		return 1;
+	}
+	
+	// the golden images depend on the SDL version that drew them
+	SDL_version version;
+	SDL_GetVersion(&version);
+	fprintf(stdout, "SDL %d.%d.%d\n", version.major, version.minor, version.patch);
+	
+	// the golden images don't depend on game.ini
+	gameOptions.useSlowAiming = false;
+	gameOptions.affectorsStay = false;
+	gameOptions.rotatingProtectors = true;
+	gameOptions.affectorLifespan = 3;
+	gameOptions.protectorLifespan = 3;
+	gameOptions.baseLifespan = 4;
+	gameOptions.fixedPoint = false;
+	
+	int failed = 0;
+	uint64_t freq = SDL_GetPerformanceFrequency();
+	int count = sizeof(renderTestFrames) / sizeof(renderTestFrames[0]);
+	for(int i = 0; i < count; i++)
+	{
+		if(renderTestFrames[i].setup != NULL) {
+			renderTestFrames[i].setup();
+		}
+		
+		memset(renderPassTime, 0, sizeof(renderPassTime));
+		renderProfiling = true;
+		uint64_t start = SDL_GetPerformanceCounter();
+		for(int r = 0; r < RENDER_TEST_REPEATS; r++) {
+			renderPassStart = SDL_GetPerformanceCounter();
+			renderTestFrames[i].draw();
+			SDL_RenderFlush(renderer);
+			render_pass_end(RENDER_PASS_OTHER);
+		}
+		double frameMs = 1000.0 * (SDL_GetPerformanceCounter() - start) / freq / RENDER_TEST_REPEATS;
+		renderProfiling = false;
+		
+		fprintf(stdout, "%-8s %7.3f ms/frame:", renderTestFrames[i].name, frameMs);
+		for(int p = 0; p < RENDER_PASS_COUNT; p++) {
+			if(renderPassTime[p] > 0) {
+				fprintf(stdout, " %s %.3f", renderPassNames[p], 1000.0 * renderPassTime[p] / freq / RENDER_TEST_REPEATS);
+			}
+		}
+		
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s.png", dir, renderTestFrames[i].name);
+		if(update) {
+			if(IMG_SavePNG(frame, path) == 0) {
+				fprintf(stdout, ", written\n");
+			} else {
+				fprintf(stdout, ", failed to write %s\n", path);
+				failed++;
+			}
+			continue;
+		}
+		SDL_Surface *golden = IMG_Load(path);
+		if(golden == NULL) {
+			fprintf(stdout, ", FAILED: no golden image %s (write it with --update-golden)\n", path);
+			failed++;
+			continue;
+		}
+		SDL_Surface *converted = SDL_ConvertSurfaceFormat(golden, SDL_PIXELFORMAT_ARGB8888, 0);
+		SDL_FreeSurface(golden);
+		float differ = (converted != NULL) ? render_test_compare(frame, converted) : -1;
+		SDL_FreeSurface(converted);
+		
+		if(differ < 0 || differ > RENDER_TEST_MAX_DIFF) {
+			snprintf(path, sizeof(path), "%s/%s-actual.png", dir, renderTestFrames[i].name);
+			IMG_SavePNG(frame, path);
+			if(differ < 0) {
+				fprintf(stdout, ", FAILED: size differs\n");
+			} else {
+				fprintf(stdout, ", FAILED: %.2f%% of the pixels differ\n", 100 * differ);
+			}
+			failed++;
+		} else {
+			fprintf(stdout, ", ok\n");
+		}
+	}
+	
+	SDL_DestroyRenderer(renderer);
+	SDL_FreeSurface(frame);
+	return failed > 0 ? 1 : 0;
+}
+
+/**
+ * Video export (--export-video).
+ * Plays a replay through the normal renderer, one frame per simulation
+ * tick and as fast as the renderer allows. The frames are read back into
+ * EXPORT_BUFFERS buffers which are allocated once and passed around in a
+ * ring: the main thread fills them, the writer thread converts them and
+ * writes them to the file. If the writer falls behind, the main thread
+ * waits for a free buffer. Files ending in .y4m get YUV4MPEG2 (4:2:0,
+ * full range BT.601), everything else raw 24 bit RGB frames.
+ **/
+#define EXPORT_BUFFERS    8
+#define EXPORT_AIM_FRAMES 45  // aim preview before each launch
+#define EXPORT_END_FRAMES 180 // final screen
+
+struct {
+	SDL_mutex *lock;
+	SDL_cond *wakeup;
+	uint8_t *buffers[EXPORT_BUFFERS];
+	int head;       // frames read back by the renderer
+	int tail;       // frames written by the writer
+	bool finished;
+	bool failed;
+	FILE *output;
+	bool y4m;
+	int width, height;
+	uint8_t *converted;
+} exportQueue;
+
+static void export_convert_y4m(uint32_t const *pixels, uint8_t *out)
+{
+	int w = exportQueue.width, h = exportQueue.height;
+	uint8_t *y = out;
+	uint8_t *cb = y + w * h;
+	uint8_t *cr = cb + (w / 2) * (h / 2);
+	for(int i = 0; i < w * h; i++) {
+		int r = (pixels[i] >> 16) & 0xFF, g = (pixels[i] >> 8) & 0xFF, b = pixels[i] & 0xFF;
+		y[i] = (77 * r + 150 * g + 29 * b) >> 8;
+	}
+	for(int j = 0; j < h / 2; j++) {
+		for(int i = 0; i < w / 2; i++) {
+			uint32_t const *p = pixels + 2 * j * w + 2 * i;
+			uint32_t quad[4] = { p[0], p[1], p[w], p[w + 1] };
+			int r = 0, g = 0, b = 0;
+			for(int k = 0; k < 4; k++) {
+				r += (quad[k] >> 16) & 0xFF;
+				g += (quad[k] >> 8) & 0xFF;
+				b += quad[k] & 0xFF;
+			}
+			r /= 4, g /= 4, b /= 4;
+			*cb++ = (-43 * r - 85 * g + 128 * b + 32768) >> 8;
+			*cr++ = (128 * r - 107 * g - 21 * b + 32768) >> 8;
+		}
+	}
+}
+
+static void export_convert_rgb(uint32_t const *pixels, uint8_t *out)
+{
+	for(int i = 0; i < exportQueue.width * exportQueue.height; i++) {
+		*out++ = (pixels[i] >> 16) & 0xFF;
+		*out++ = (pixels[i] >> 8) & 0xFF;
+		*out++ = pixels[i] & 0xFF;
+	}
+}
+
+static int export_writer(void *arg)
+{
+	int w = exportQueue.width, h = exportQueue.height;
+	int size = exportQueue.y4m ? (w * h + 2 * (w / 2) * (h / 2)) : (3 * w * h);
+	while(true)
+	{
+		SDL_LockMutex(exportQueue.lock);
+		while(exportQueue.tail == exportQueue.head && exportQueue.finished == false) {
+			SDL_CondWait(exportQueue.wakeup, exportQueue.lock);
+		}
+		if(exportQueue.tail == exportQueue.head) {
+			SDL_UnlockMutex(exportQueue.lock);
+			return 0;
+		}
+		uint32_t const *pixels = (uint32_t const*)exportQueue.buffers[exportQueue.tail % EXPORT_BUFFERS];
+		SDL_UnlockMutex(exportQueue.lock);
+		
+		bool ok = true;
+		if(exportQueue.y4m) {
+			export_convert_y4m(pixels, exportQueue.converted);
+			ok = fputs("FRAME\n", exportQueue.output) >= 0;
+		} else {
+			export_convert_rgb(pixels, exportQueue.converted);
+		}
+		ok = ok && fwrite(exportQueue.converted, 1, size, exportQueue.output) == (size_t)size;
+		
+		SDL_LockMutex(exportQueue.lock);
+		exportQueue.tail += 1;
+		if(ok == false) {
+			exportQueue.failed = true;
+		}
+		SDL_CondBroadcast(exportQueue.wakeup);
+		SDL_UnlockMutex(exportQueue.lock);
+	}
+}
+
+/**
+ * Reads the current frame back into the next free buffer.
+ **/
+static bool export_frame()
+{
+	SDL_LockMutex(exportQueue.lock);
+	while(exportQueue.head - exportQueue.tail >= EXPORT_BUFFERS && exportQueue.failed == false) {
+		SDL_CondWait(exportQueue.wakeup, exportQueue.lock);
+	}
+	bool failed = exportQueue.failed;
+	uint8_t *buffer = exportQueue.buffers[exportQueue.head % EXPORT_BUFFERS];
+	SDL_UnlockMutex(exportQueue.lock);
+	if(failed) {
+		return false;
+	}
+	
+	if(SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888, buffer, 4 * exportQueue.width) < 0) {
+		fprintf(stderr, "Failed to read the frame: %s\n", SDL_GetError());
+		return false;
+	}
+	
+	SDL_LockMutex(exportQueue.lock);
+	exportQueue.head += 1;
+	SDL_CondSignal(exportQueue.wakeup);
+	SDL_UnlockMutex(exportQueue.lock);
+	return true;
+}
+
+/**
+ * Renders the replay turn by turn, returns false if a frame couldn't be
+ * exported.
+ **/
+static bool export_replay(uint8_t const *p, uint8_t const *end)
+{
+	bool desync = false;
+	base_t *player = &leftBase;
+	for(int turnIndex = 0; p < end; turnIndex++)
+	{
+		uint16_t size;
+		turn_t turn;
+		if((end - p) < 2) {
+			LOG_WARN("Replay ends in a truncated turn");
+			break;
+		}
+		p = get_u16(p, &size);
+		if((end - p) < size || turn_decode(p, size, &turn) == false) {
+			LOG_WARN("Replay ends in a malformed turn");
+			break;
+		}
+		p += size;
+		uint8_t const *hashes;
+		int ticks;
+		if((p = replay_battle_decode(p, end, &hashes, &ticks)) == NULL) {
+			LOG_WARN("Replay ends in a truncated battle");
+			break;
+		}
+		
+		turn_begin(player);
+		if(turn.hash != state_hash() && desync == false) {
+			LOG_WARN("Turn %d doesn't match the recorded state, the video will differ from the match", turnIndex);
+			desync = true;
+		}
+		float angle = apply_turn(player, &turn);
+		
+		for(int i = 0; i < EXPORT_AIM_FRAMES; i++)
+		{
+			battleTime = (turn.time / 1000.0) - (EXPORT_AIM_FRAMES - i) * SIM_DT;
+			SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+			SDL_RenderClear(renderer);
+			render_battleground();
+			render_aim_preview(player, angle);
+			render_tool_panels(NULL);
+			if(export_frame() == false) {
+				return false;
+			}
+		}
+		battleTime = turn.time / 1000.0;
+		launch_projectile(player, angle);
+		
+		int state;
+		for(int tick = 0; true; tick++)
+		{
+			state = battle_tick(SIM_DT);
+			if(hashes != NULL && desync == false &&
+			   (replay_tick_differs(hashes, ticks, tick) || (state != BATTLE_RUNNING && tick + 1 < ticks))) {
+				LOG_WARN("Tick %d of turn %d doesn't match the recorded battle, the video will differ from the match", tick, turnIndex);
+				desync = true;
+			}
+			if(state != BATTLE_RUNNING) {
+				break;
+			}
+			SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+			SDL_RenderClear(renderer);
+			render_battleground();
+			render_tool_panels(NULL);
+			if(export_frame() == false) {
+				return false;
+			}
+		}
+		
+		if(state == BATTLE_LEFT_DESTROYED || state == BATTLE_RIGHT_DESTROYED) {
+			SDL_Rect fullscreen = { 0, 0, 1280, 720 };
+			SDL_RenderCopy(renderer, (state == BATTLE_LEFT_DESTROYED) ? texFinalGreen : texFinalBlue, NULL, &fullscreen);
+			for(int i = 0; i < EXPORT_END_FRAMES; i++) {
+				if(export_frame() == false) {
+					return false;
+				}
+			}
+			break;
+		}
+		player = (player == &leftBase) ? &rightBase : &leftBase;
+	}
+	return true;
+}
+
+/**
+ * Creates the output file and the buffers of an export. Returns false if
+ * anything fails, export_close() then releases what was set up.
+ **/
+static bool export_open(const char *file, int width, int height)
+{
+	exportQueue.width = width;
+	exportQueue.height = height;
+	exportQueue.y4m = strlen(file) >= 4 && strcasecmp(file + strlen(file) - 4, ".y4m") == 0;
+	exportQueue.output = fopen(file, "wb");
+	if(exportQueue.output == NULL) {
+		fprintf(stderr, "Failed to create %s\n", file);
+		return false;
+	}
+	for(int i = 0; i < EXPORT_BUFFERS; i++) {
+		exportQueue.buffers[i] = malloc(4 * width * height);
+		if(exportQueue.buffers[i] == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return false;
+		}
+	}
+	exportQueue.converted = malloc(3 * width * height);
+	if(exportQueue.converted == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+	if(exportQueue.y4m) {
+		fprintf(exportQueue.output, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, SIM_RATE);
+	}
+	return true;
+}
+
+/**
+ * Closes the output and frees the buffers of an export, whatever
+ * export_open() got to. Returns false if the output can't be written.
+ **/
+static bool export_close()
+{
+	bool ok = true;
+	if(exportQueue.output != NULL) {
+		ok = (fclose(exportQueue.output) == 0);
+		exportQueue.output = NULL;
+	}
+	for(int i = 0; i < EXPORT_BUFFERS; i++) {
+		free(exportQueue.buffers[i]);
+		exportQueue.buffers[i] = NULL;
+	}
+	free(exportQueue.converted);
+	exportQueue.converted = NULL;
+	return ok;
+}
+
+int export_video(const char *replay, const char *file)
+{
+	FILE *f = fopen(replay, "rb");
+	if(f == NULL) {
+		fprintf(stderr, "Failed to open %s\n", replay);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data = malloc(len > 0 ? len : 1);
+	if(data == NULL || fread(data, 1, len, f) != (size_t)len) {
+		fprintf(stderr, "Failed to read %s\n", replay);
+		fclose(f);
+		free(data);
+		return 1;
+	}
+	fclose(f);
+	if(len < (8 + OPTIONS_SIZE) || memcmp(data, REPLAY_MAGIC, 8) != 0) {
+		fprintf(stderr, "%s is not a replay\n", replay);
+		free(data);
+		return 1;
+	}
+	
+	SDL_Surface *frame = headless_init();
+	if(frame == NULL) {
+		free(data);
+		return 1;
+	}
+	int level;
+	uint8_t const *turns = options_decode(data + 8, &level);
+	char name[256];
+	sprintf(name, "levels/%02d.txt", level);
+	load_level(name);
+	match_init();
+	
+	SDL_Thread *writer = NULL;
+	bool ok = export_open(file, frame->w, frame->h);
+	if(ok) {
+		exportQueue.lock = SDL_CreateMutex();
+		exportQueue.wakeup = SDL_CreateCond();
+		writer = SDL_CreateThread(export_writer, "export", NULL);
+		if(writer == NULL) {
+			fprintf(stderr, "Failed to start the writer: %s\n", SDL_GetError());
+			ok = false;
+		}
+	}
+	
+	if(writer != NULL) {
+		uint64_t start = SDL_GetPerformanceCounter();
+		ok = export_replay(turns, data + len);
+		
+		SDL_LockMutex(exportQueue.lock);
+		exportQueue.finished = true;
+		SDL_CondSignal(exportQueue.wakeup);
+		SDL_UnlockMutex(exportQueue.lock);
+		SDL_WaitThread(writer, NULL);
+		double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+		
+		if(export_close() == false || exportQueue.failed) {
+			fprintf(stderr, "Failed to write %s\n", file);
+			ok = false;
+		}
+		double length = (double)exportQueue.tail / SIM_RATE;
+		fprintf(stdout, "Exported %d frames (%.1f s of video) in %.2f s, %.1fx real time.\n",
+			exportQueue.tail, length, seconds, length / (seconds > 0 ? seconds : 1));
+	} else {
+		export_close();
+	}
+	
+	SDL_DestroyCond(exportQueue.wakeup);
+	SDL_DestroyMutex(exportQueue.lock);
+	SDL_DestroyRenderer(renderer);
+	SDL_FreeSurface(frame);
+	free(data);
+	return ok ? 0 : 1;
+}
+
+/*
+struct {
+	bool useSlowAiming;
+	bool affectorsStay;
+	bool rotatingProtectors;
+	int affectorLifespan;
+	int protectorLifespan;
+	int baseLifespan;
+} gameOptions = {
+	useSlowAiming      =  true,
+	affectorsStay      =  true, 
+	rotatingProtectors =  true,
+	affectorLifespan   =  3, // 0-...
+	protectorLifespan  =  3, // 0-3
+	baseLifespan       =  4, // 1-10
+};
+*/
+
+#if defined(_MSC_VER)
+// windows
+
+void load_options();
+
+bool net_listen(int port)
+{
+	fprintf(stderr, "Network play is not supported on this platform.\n");
+	return false;
+}
+
+bool net_connect(const char *host, int port)
+{
+	fprintf(stderr, "Network play is not supported on this platform.\n");
+	return false;
+}
+
+bool net_write(void const *data, int len)
+{
+	return false;
+}
+
+bool net_read(void *data, int len)
+{
+	return false;
+}
+
+bool net_readable()
+{
+	return true;
+}
+
+int verify_daemon(const char *path, int workers)
+{
+	fprintf(stderr, "The verification daemon is not supported on this platform.\n");
+	return 1;
+}
+
+int verify_client(const char *path, int count, char **files)
+{
+	fprintf(stderr, "The verification daemon is not supported on this platform.\n");
+	return 1;
+}
+
+bool spectate_listen(const char *path)
+{
+	fprintf(stderr, "Spectating is not supported on this platform.\n");
+	return false;
+}
+
+void spectate_drop(int viewer)
+{
+}
+
+void spectate_flush()
+{
+}
+
+int spectate_client(const char *path)
+{
+	fprintf(stderr, "Spectating is not supported on this platform.\n");
+	return 1;
+}
+
+bool stats_open(const char *name)
+{
+	fprintf(stderr, "Shared memory statistics are not supported on this platform.\n");
+	return false;
+}
+
+int stats_read(const char *name, int interval)
+{
+	fprintf(stderr, "Shared memory statistics are not supported on this platform.\n");
+	return 1;
+}
+
+#else
+// linux
+
+void load_options()
+{
+	dictionary * ini = iniparser_load("game.ini");
+	
+	if(ini == NULL) {
+		LOG_WARN("Failed to load game.ini, fallback to default options.");
+		return;
+	}
+	
+	gameOptions.useSlowAiming      = iniparser_getboolean(ini, "iaim:slowaiming", 0);
+	gameOptions.affectorsStay      = iniparser_getboolean(ini, "iaim:affectorsstay", 0);
+	gameOptions.rotatingProtectors = iniparser_getboolean(ini, "iaim:rotatingbarricade", 0);
+	
+	
+	gameOptions.affectorLifespan   = iniparser_getint(ini, "iaim:affectorlifespan", 3);
+	gameOptions.protectorLifespan  = iniparser_getint(ini, "iaim:protectorlifespan", 3);
+	gameOptions.baseLifespan       = iniparser_getint(ini, "iaim:baselifespan", 4);
+	gameOptions.fixedPoint         = iniparser_getboolean(ini, "iaim:fixedpoint", 0);
+	double theta                   = iniparser_getdouble(ini, "iaim:fieldtheta", 0.0);
+	gameOptions.fieldTheta         = lround(MAX(0.0, MIN(1.0, theta)) * 1000);
+	
+	const char *level = iniparser_getstring(ini, "iaim:loglevel", "info");
+	for(int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_ERROR; i++) {
+		if(strcasecmp(level, logLevelNames[i]) == 0) {
+			logLevel = i;
+		}
+	}
+	snprintf(logFile, sizeof(logFile), "%s", iniparser_getstring(ini, "iaim:logfile", ""));
+	
+	if(gameOptions.affectorLifespan < 1)
+		gameOptions.affectorLifespan = 1;
+	if(gameOptions.protectorLifespan < 0)
+		gameOptions.protectorLifespan = 0;
+	if(gameOptions.protectorLifespan > 3)
+		gameOptions.protectorLifespan = 3;
+	if(gameOptions.baseLifespan < 1)
+		gameOptions.baseLifespan = 1;
+	if(gameOptions.baseLifespan > 10)
+		gameOptions.baseLifespan = 10;
+	
+	LOG_DEBUG("Options: slowAiming=%d affectorsStay=%d rotatingBarricade=%d affectorLifespan=%d protectorLifespan=%d baseLifespan=%d fixedPoint=%d fieldTheta=%.3f",
+		gameOptions.useSlowAiming, gameOptions.affectorsStay, gameOptions.rotatingProtectors,
+		gameOptions.affectorLifespan, gameOptions.protectorLifespan, gameOptions.baseLifespan,
+		gameOptions.fixedPoint, gameOptions.fieldTheta / 1000.0);
+	
+	iniparser_freedict(ini);
+}
+
+int netSocket = -1;
+
+static void net_configure(int fd)
+{
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+bool net_listen(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0) {
+		perror("socket");
+		return false;
+	}
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		perror("bind");
+		close(fd);
+		return false;
+	}
+	netSocket = accept(fd, NULL, NULL);
+	close(fd);
+	if(netSocket < 0) {
+		perror("accept");
+		return false;
+	}
+	net_configure(netSocket);
+	return true;
+}
+
+bool net_connect(const char *host, int port)
+{
+	char service[16];
+	sprintf(service, "%d", port);
+	
+	struct addrinfo hints = { 0 };
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *result;
+	int err = getaddrinfo(host, service, &hints, &result);
+	if(err != 0) {
+		fprintf(stderr, "Failed to resolve %s: %s\n", host, gai_strerror(err));
+		return false;
+	}
+	// retry for a while, the host may still be starting up
+	for(int retry = 0; retry < 50 && netSocket < 0; retry++) {
+		if(retry > 0) {
+			SDL_Delay(100);
+		}
+		for(struct addrinfo *it = result; it != NULL; it = it->ai_next) {
+			int fd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+			if(fd < 0) {
+				continue;
+			}
+			if(connect(fd, it->ai_addr, it->ai_addrlen) == 0) {
+				netSocket = fd;
+				break;
+			}
+			close(fd);
+		}
+	}
+	freeaddrinfo(result);
+	if(netSocket < 0) {
+		fprintf(stderr, "Failed to connect to %s:%d\n", host, port);
+		return false;
+	}
+	net_configure(netSocket);
+	return true;
+}
+
+bool net_write(void const *data, int len)
+{
+	uint8_t const *p = data;
+	while(len > 0) {
+		ssize_t n = send(netSocket, p, len, MSG_NOSIGNAL);
+		if(n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool net_read(void *data, int len)
+{
+	uint8_t *p = data;
+	while(len > 0) {
+		ssize_t n = recv(netSocket, p, len, 0);
+		if(n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Returns true if net_read() won't block (data or a closed connection).
+ **/
+bool net_readable()
+{
+	struct pollfd fd = { netSocket, POLLIN, 0 };
+	return poll(&fd, 1, 0) != 0;
+}
+
+/**
+ * Replay verification daemon.
+ * Clients connect to a unix socket and send replays, each as a 32 bit
+ * little endian length followed by the replay file. Every replay is
+ * answered with one line, in any order, tagged with the index of the
+ * replay on that connection:
+ *   OK <index> winner=<none|left|right> turns=<n> desync=<turn|-> tick=<tick|-> lifepoints=<l>,<r> protectors=<24 digits>,<24 digits>
+ *   ERROR <index> <reason>
+ * Replays must have been played with the options of the daemon's game.ini,
+ * others are answered with ERROR <index> other options.
+ * A request of length 0 is answered with a STATS line that holds the
+ * queue latency percentiles in microseconds.
+ * The connections are non-blocking, so a client that sends half a replay
+ * only holds up itself. Answers are queued per connection and sent by the
+ * poll loop whenever the client takes them, nothing waits for a client.
+ * A client that leaves more than VERIFY_MAX_BACKLOG bytes of answers
+ * unread is disconnected. While VERIFY_MAX_PENDING replays wait for a
+ * worker, further ones are answered with ERROR <index> busy. Clients
+ * beyond VERIFY_MAX_CLIENTS are closed right away.
+ **/
+#define VERIFY_MAX_REPLAY      (1 << 20)
+#define VERIFY_MAX_CLIENTS     64
+#define VERIFY_MAX_PENDING     256
+#define VERIFY_LATENCY_SAMPLES 4096
+#define VERIFY_REPORT_INTERVAL 10000
+#define VERIFY_MAX_BACKLOG     (64 * 1024) // bytes of unread answers per client
+
+typedef struct {
+	int fd;
+	uint32_t nextIndex;
+	SDL_atomic_t refs;
+	// request being read
+	uint8_t header[4];
+	int headerRead;
+	uint32_t len;
+	uint8_t *data;
+	uint32_t dataRead;
+	bool eof; // the client sends nothing more, but may still wait for answers
+	// answers not sent yet, shared with the workers
+	SDL_mutex *lock;
+	bool broken; // the client is gone or didn't read its answers
+	int outLen;
+	char out[VERIFY_MAX_BACKLOG];
+} verify_conn_t;
+
+typedef struct verify_job {
+	verify_conn_t *conn;
+	uint32_t index;
+	uint64_t queued;
+	int len;
+	uint8_t *data;
+	struct verify_job *next;
+} verify_job_t;
+
+struct {
+	SDL_mutex *lock;
+	SDL_cond *wakeup;
+	verify_job_t *head;
+	verify_job_t *tail;
+	int pending;
+	uint64_t verified;
+	uint64_t failed;
+	uint32_t latency[VERIFY_LATENCY_SAMPLES]; // ring of queue latencies in µs
+	int latencyCount;
+} verifyQueue;
+
+game_options_t verifyOptions; // of game.ini, the workers only see the defaults in gameOptions
+int verifyWakeup[2]; // pipe, makes the poll loop look at the queued answers
+
+static void verify_release(verify_conn_t *conn)
+{
+	if(SDL_AtomicAdd(&conn->refs, -1) == 1) {
+		close(conn->fd);
+		SDL_DestroyMutex(conn->lock);
+		free(conn);
+	}
+}
+
+/**
+ * Sends as much of the queued answers as the client takes without
+ * blocking. The caller holds conn->lock.
+ **/
+static void verify_flush(verify_conn_t *conn)
+{
+	while(conn->outLen > 0 && conn->broken == false) {
+		ssize_t n = send(conn->fd, conn->out, conn->outLen, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		}
+		if(n <= 0) {
+			conn->broken = true;
+			return;
+		}
+		memmove(conn->out, conn->out + n, conn->outLen - n);
+		conn->outLen -= n;
+	}
+}
+
+/**
+ * Queues an answer and sends what the client takes right away, the poll
+ * loop sends the rest. Runs on any thread.
+ **/
+static void verify_answer(verify_conn_t *conn, const char *line)
+{
+	int len = strlen(line);
+	SDL_LockMutex(conn->lock);
+	if(conn->outLen + len > VERIFY_MAX_BACKLOG) {
+		conn->broken = true;
+	}
+	if(conn->broken == false) {
+		memcpy(conn->out + conn->outLen, line, len);
+		conn->outLen += len;
+		verify_flush(conn);
+	}
+	SDL_UnlockMutex(conn->lock);
+	
+	char wake = 0;
+	if(write(verifyWakeup[1], &wake, 1) < 0) {
+		// the pipe is full, so the poll loop wakes up anyway
+	}
+}
+
+static bool verify_broken(verify_conn_t *conn)
+{
+	SDL_LockMutex(conn->lock);
+	bool broken = conn->broken;
+	SDL_UnlockMutex(conn->lock);
+	return broken;
+}
+
+static int verify_worker(void *arg)
+{
+	uint64_t freq = SDL_GetPerformanceFrequency();
+	while(true)
+	{
+		SDL_LockMutex(verifyQueue.lock);
+		while(verifyQueue.head == NULL) {
+			SDL_CondWait(verifyQueue.wakeup, verifyQueue.lock);
+		}
+		verify_job_t *job = verifyQueue.head;
+		verifyQueue.head = job->next;
+		if(verifyQueue.head == NULL) {
+			verifyQueue.tail = NULL;
+		}
+		verifyQueue.pending -= 1;
+		SDL_UnlockMutex(verifyQueue.lock);
+		
+		uint32_t latency = (SDL_GetPerformanceCounter() - job->queued) * 1000000 / freq;
+		
+		replay_result_t r;
+		const char *error = NULL;
+		char line[256];
+		bool ok = replay_verify(job->data, job->len, &verifyOptions, &r, &error);
+		if(ok) {
+			const char *winner[] = { "none", "left", "right" };
+			char desync[16] = "-";
+			char tick[16] = "-";
+			char protectors[2][25];
+			for(int i = 0; i < 2; i++) {
+				for(int j = 0; j < 24; j++) {
+					protectors[i][j] = '0' + r.protectors[i][j];
+				}
+				protectors[i][24] = 0;
 			}
-				
-			SDL_Rect rightPanel = {
-				battleground.x + battleground.w, 0, 128, 720
-			};
-			if(player == &rightBase) {
-				
-				SDL_RenderCopy(
-					renderer,
-					texBackPanel,
-					NULL,
-					&rightPanel);
-				SDL_Rect target = {
-					battleground.x + battleground.w + 32, 32, 
-					64, 64
-				};
-				for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) {
-					int count = player->resources[i];
-					if(count <= 0) {
-						continue;
-					}
-				
-					SDL_RenderCopyEx(
-						renderer,
-						texAffector[i],
-						NULL,
-						&target,
-						180,
-						NULL,
-						SDL_FLIP_NONE);
-					
-					SDL_Rect number = {
-						target.x + 48, target.y + 48,
-						16, 16
-					};
-					SDL_Rect numberSrc = {
-						16 * count, 0,
-						16, 16
-					};
-					SDL_RenderCopy(
-						renderer,
-						texNumbers,
-						&numberSrc,
-						&number);
-				
-					target.y += 96;
-				}
-			} else {
-				SDL_RenderCopy(
-					renderer,
-					texRightPanel,
-					NULL,
-					&rightPanel);
+			if(r.desyncTurn >= 0) {
+				sprintf(desync, "%d", r.desyncTurn);
 			}
+			if(r.desyncTick >= 0) {
+				sprintf(tick, "%d", r.desyncTick);
+			}
+			snprintf(line, sizeof(line), "OK %u winner=%s turns=%d desync=%s tick=%s lifepoints=%d,%d protectors=%s,%s\n",
+				job->index, winner[r.winner], r.turns, desync, tick,
+				r.lifepoints[0], r.lifepoints[1], protectors[0], protectors[1]);
+		} else {
+			snprintf(line, sizeof(line), "ERROR %u %s\n", job->index, error);
 		}
+		verify_answer(job->conn, line);
 		
-		{ // Launch Button
-			int x,y;
-			int buttons = SDL_GetMouseState(&x, &y);
-			
-			SDL_Rect button = {
-				16, 668,
-				96, 36
-			};
-			if(player == &rightBase) {
-				button.x += battleground.x + battleground.w;
-			}
-			SDL_Texture *tex = texButtonLaunch[BUTTON_NORMAL];
-			
-			if(x >= button.x && x < (button.x + button.w) &&
-			   y >= button.y && y < (button.y + button.h)) 
-			{
-				if(buttons & SDL_BUTTON(SDL_BUTTON_LEFT)) {
-					tex = texButtonLaunch[BUTTON_PRESSED];
-				} else {
-					tex = texButtonLaunch[BUTTON_HOVER];
-				}
-			}
-			
-			SDL_RenderCopy(
-				renderer,
-				tex,
-				NULL,
-				&button);
+		SDL_LockMutex(verifyQueue.lock);
+		verifyQueue.latency[verifyQueue.latencyCount++ % VERIFY_LATENCY_SAMPLES] = latency;
+		if(ok) {
+			verifyQueue.verified += 1;
+		} else {
+			verifyQueue.failed += 1;
 		}
+		SDL_UnlockMutex(verifyQueue.lock);
 		
-		if(draggingAffector >= 0)
-		{
-			SDL_Rect target = {
-				0, 0,
-				64, 64
-			};
-			
-			SDL_GetMouseState(&target.x, &target.y);
-			target.x -= 32;
-			target.y -= 32;
-				
-			SDL_RenderCopyEx(
-				renderer,
-				texAffector[draggingAffector],
-				NULL,
-				&target,
-				(player == &rightBase) ? 180 : 0,
-				NULL,
-				SDL_FLIP_NONE);
+		verify_release(job->conn);
+		free(job->data);
+		free(job);
+	}
+	return 0;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(uint32_t const *)a;
+	uint32_t y = *(uint32_t const *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Formats the STATS line, returns the number of answered replays.
+ **/
+static uint64_t verify_stats(char *line, int size)
+{
+	static uint32_t samples[VERIFY_LATENCY_SAMPLES];
+	
+	SDL_LockMutex(verifyQueue.lock);
+	int count = MIN(verifyQueue.latencyCount, VERIFY_LATENCY_SAMPLES);
+	memcpy(samples, verifyQueue.latency, count * sizeof(uint32_t));
+	uint64_t verified = verifyQueue.verified;
+	uint64_t failed = verifyQueue.failed;
+	int pending = verifyQueue.pending;
+	SDL_UnlockMutex(verifyQueue.lock);
+	
+	qsort(samples, count, sizeof(uint32_t), compare_u32);
+#define PERCENTILE(p) (count > 0 ? samples[(count - 1) * (p) / 100] : 0)
+	snprintf(line, size, "STATS verified=%llu failed=%llu pending=%d latency_us p50=%u p90=%u p99=%u max=%u\n",
+		(unsigned long long)verified, (unsigned long long)failed, pending,
+		PERCENTILE(50), PERCENTILE(90), PERCENTILE(99), PERCENTILE(100));
+#undef PERCENTILE
+	return verified + failed;
+}
+
+/**
+ * Queues a replay that was read completely, or answers that the daemon
+ * is busy.
+ **/
+static void verify_submit(verify_conn_t *conn, uint8_t *data, int len)
+{
+	uint32_t index = conn->nextIndex++;
+	SDL_LockMutex(verifyQueue.lock);
+	if(verifyQueue.pending >= VERIFY_MAX_PENDING) {
+		SDL_UnlockMutex(verifyQueue.lock);
+		char line[64];
+		snprintf(line, sizeof(line), "ERROR %u busy\n", index);
+		verify_answer(conn, line);
+		free(data);
+		return;
+	}
+	
+	verify_job_t *job = malloc(sizeof(verify_job_t));
+	if(job == NULL) {
+		SDL_UnlockMutex(verifyQueue.lock);
+		char line[64];
+		snprintf(line, sizeof(line), "ERROR %u out of memory\n", index);
+		verify_answer(conn, line);
+		free(data);
+		return;
+	}
+	job->conn = conn;
+	job->index = index;
+	job->queued = SDL_GetPerformanceCounter();
+	job->len = len;
+	job->data = data;
+	job->next = NULL;
+	SDL_AtomicAdd(&conn->refs, 1);
+	
+	if(verifyQueue.tail != NULL) {
+		verifyQueue.tail->next = job;
+	} else {
+		verifyQueue.head = job;
+	}
+	verifyQueue.tail = job;
+	verifyQueue.pending += 1;
+	SDL_CondSignal(verifyQueue.wakeup);
+	SDL_UnlockMutex(verifyQueue.lock);
+}
+
+/**
+ * Reads whatever a client has sent without blocking and submits every
+ * complete request. Returns false when the connection is broken, and
+ * sets conn->eof when the client has finished sending.
+ **/
+static bool verify_read(verify_conn_t *conn)
+{
+	while(true)
+	{
+		ssize_t n;
+		if(conn->headerRead < 4) {
+			n = recv(conn->fd, conn->header + conn->headerRead, 4 - conn->headerRead, 0);
+		} else {
+			n = recv(conn->fd, conn->data + conn->dataRead, conn->len - conn->dataRead, 0);
+		}
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		}
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n == 0 && conn->headerRead == 0) {
+			conn->eof = true;
+			return true;
+		}
+		if(n <= 0) {
+			return false;
 		}
 		
-		if(currentAffector != NULL)
-		{
-			SDL_SetRenderDrawColor(
-				renderer,
-				192, 192, 192, 255);
-				
-			float2 pos = {
-				48 * cosf(DEG_TO_RAD(-currentAffector->rotation)),
-				-48 * sinf(DEG_TO_RAD(-currentAffector->rotation)),
-			};
-			pos.x += currentAffector->center.x;
-			pos.y += currentAffector->center.y;
-			SDL_RenderDrawLine(
-				renderer,
-				currentAffector->center.x + battleground.x, currentAffector->center.y,
-				battleground.x + pos.x, pos.y);
-			
-			SDL_Rect grabbag = {
-				battleground.x + pos.x - 6, pos.y - 6,
-				12, 12
-			};
-			if(isRotating) {
-				SDL_SetRenderDrawColor(
-					renderer,
-					255, 128, 128, 255);
+		if(conn->headerRead < 4) {
+			conn->headerRead += n;
+			if(conn->headerRead < 4) {
+				continue;
+			}
+			get_u32(conn->header, &conn->len);
+			if(conn->len == 0) {
+				char line[256];
+				verify_stats(line, sizeof(line));
+				verify_answer(conn, line);
+				conn->headerRead = 0;
+				if(verify_broken(conn)) {
+					return false;
+				}
+				continue;
+			}
+			if(conn->len > VERIFY_MAX_REPLAY) {
+				verify_answer(conn, "ERROR - replay too large\n");
+				return false;
+			}
+			conn->data = malloc(conn->len);
+			conn->dataRead = 0;
+			if(conn->data == NULL) {
+				return false;
 			}
-			SDL_RenderFillRect(renderer, &grabbag);
+			continue;
 		}
 		
-		SDL_RenderPresent(renderer);
-		
-		while(SDL_GetTicks() < nextFrameTime) {
-			; // BURN!
+		conn->dataRead += n;
+		if(conn->dataRead == conn->len) {
+			verify_submit(conn, conn->data, conn->len);
+			conn->data = NULL;
+			conn->headerRead = 0;
+			if(verify_broken(conn)) {
+				return false;
+			}
 		}
-		nextFrameTime = SDL_GetTicks() + 15;
 	}
 }
 
-void start_round(const char *level)
+int verify_daemon(const char *path, int workers)
 {
-	// Load level
-	load_level(level);
-
-	// Initialize game state	
-	leftBase = (base_t) {
-		{ 92, 75, 255, 255 },
-		{ 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3 },
-		{ 0, 0, 0, 0, 0 },
-		AFFECTOR_COOLDOWNS,
-		BASE_LIFEPOINTS
-	};
-
-	rightBase = (base_t) {
-		{ 85, 182, 74, 255 },
-		{ 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3 },
-		{ 0, 0, 0, 0, 0 },
-		AFFECTOR_COOLDOWNS,
-		BASE_LIFEPOINTS
-	};
+	if(levels_preload() == 0) {
+		fprintf(stderr, "No levels found.\n");
+		return 1;
+	}
+	if(workers <= 0) {
+		workers = SDL_GetCPUCount();
+	}
+	verifyOptions = gameOptions;
 	
-	for(int i = 0; i < 24; i++) {
-		leftBase.protectors[i] = PROTECTOR_LIFE;
-		rightBase.protectors[i] = PROTECTOR_LIFE;
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr = { 0 };
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+	if(server < 0 || bind(server, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server, 16) < 0) {
+		perror(path);
+		return 1;
 	}
 	
-	battleTime = 0.0;
+	if(pipe(verifyWakeup) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	fcntl(verifyWakeup[0], F_SETFL, fcntl(verifyWakeup[0], F_GETFL) | O_NONBLOCK);
+	fcntl(verifyWakeup[1], F_SETFL, fcntl(verifyWakeup[1], F_GETFL) | O_NONBLOCK);
 	
-	// Start game
-	base_t *player = &leftBase;
-	isGameRunning = true;
+	verifyQueue.lock = SDL_CreateMutex();
+	verifyQueue.wakeup = SDL_CreateCond();
+	for(int i = 0; i < workers; i++) {
+		SDL_DetachThread(SDL_CreateThread(verify_worker, "verify", NULL));
+	}
+	fprintf(stderr, "Verifying replays on %s with %d workers.\n", path, workers);
+	
+	// the server and the wakeup pipe, then the clients
+	struct pollfd fds[VERIFY_MAX_CLIENTS + 2];
+	verify_conn_t *conns[VERIFY_MAX_CLIENTS + 2];
+	int count = 2;
+	fds[0] = (struct pollfd){ server, POLLIN, 0 };
+	fds[1] = (struct pollfd){ verifyWakeup[0], POLLIN, 0 };
+	
+	uint32_t nextReport = SDL_GetTicks() + VERIFY_REPORT_INTERVAL;
+	uint64_t lastReported = 0;
 	while(true)
 	{
-		fprintf(stdout, "Reset battle...\n");
-		battle_reset();
-		if(isGameRunning == false) return;
-		
-		fprintf(stdout, "Resupplement...\n");
-		for(int i = 0; i < AFFECTOR_TYPE_COUNT; i++) 
-		{
-			player->respawn[i] -= 1;
-			if(player->respawn[i] <= 0) {
-				player->resources[i] += 1;
-				player->respawn[i] = cooldowns[i];
-			}
+		for(int i = 2; i < count; i++) {
+			SDL_LockMutex(conns[i]->lock);
+			fds[i].events = (conns[i]->eof ? 0 : POLLIN) | (conns[i]->outLen > 0 ? POLLOUT : 0);
+			SDL_UnlockMutex(conns[i]->lock);
 		}
+		poll(fds, count, 1000);
 		
-		do {
-			fprintf(stdout, "Battle setup...\n");
-			player_build(player);
-			if(isGameRunning == false) return;
+		if(fds[1].revents & POLLIN) {
+			char drain[64];
+			while(read(verifyWakeup[0], drain, sizeof(drain)) > 0);
+		}
 		
-			fprintf(stdout, "Start aiming...\n");
-		} while(player_aim(player) == false);
+		if(SDL_GetTicks() >= nextReport) {
+			char line[256];
+			uint64_t answered = verify_stats(line, sizeof(line));
+			if(answered != lastReported) {
+				fputs(line, stderr);
+				lastReported = answered;
+			}
+			nextReport = SDL_GetTicks() + VERIFY_REPORT_INTERVAL;
+		}
 		
-		// todo: 
-		fprintf(stdout, "Battle simulation...\n");
-		battle_simulation();
-		if(isGameRunning == false) return;
+		if(fds[0].revents & POLLIN) {
+			int fd = accept(server, NULL, NULL);
+			if(fd >= 0 && count >= VERIFY_MAX_CLIENTS + 2) {
+				const char *full = "ERROR - too many clients\n";
+				send(fd, full, strlen(full), MSG_DONTWAIT | MSG_NOSIGNAL);
+				close(fd);
+			} else if(fd >= 0) {
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+				verify_conn_t *conn = calloc(1, sizeof(verify_conn_t));
+				conn->fd = fd;
+				conn->lock = SDL_CreateMutex();
+				SDL_AtomicSet(&conn->refs, 1);
+				conns[count] = conn;
+				fds[count++] = (struct pollfd){ fd, POLLIN, 0 };
+			}
+		}
 		
-		if(player == &leftBase) {
-			player = &rightBase;
-		} else {
-			player = &leftBase;
+		for(int i = 2; i < count; i++)
+		{
+			verify_conn_t *conn = conns[i];
+			bool open = true;
+			if(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				open = (conn->eof || verify_read(conn));
+			}
+			if((fds[i].revents & (POLLHUP | POLLERR)) && conn->eof) {
+				open = false; // nobody reads the answers anymore
+			}
+			
+			SDL_LockMutex(conn->lock);
+			verify_flush(conn);
+			if(conn->broken) {
+				open = false;
+			}
+			// a client that finished sending is done when all its answers are sent
+			if(conn->eof && conn->outLen == 0 && SDL_AtomicGet(&conn->refs) == 1) {
+				open = false;
+			}
+			if(open == false) {
+				conn->broken = true;
+			}
+			SDL_UnlockMutex(conn->lock);
+			
+			if(open == false) {
+				// forget the connection, the workers may still hold a reference
+				shutdown(conn->fd, SHUT_RDWR);
+				free(conn->data);
+				conn->data = NULL;
+				verify_release(conn);
+				conns[i] = conns[count - 1];
+				fds[i] = fds[count - 1];
+				count -= 1;
+				i -= 1;
+			}
 		}
 	}
+	return 0;
 }
 
-void load_level(const char *file)
+/**
+ * Sends replay files to a verification daemon and prints the answers.
+ **/
+int verify_client(const char *path, int count, char **files)
 {
-	FILE *f = fopen(file, "r");
-
-	fscanf(f, "iAIM Level 1.0\n");
-	if(ferror(f)) {
-		fprintf(stderr, "Failed to load level %s\n", file);
-		exit(1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr = { 0 };
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror(path);
+		return 1;
 	}
 	
-	// clean current level first:
-	for(block_t *b = blockchain; b != NULL;)
+	int sent = 0;
+	for(int i = 0; i <= count; i++)
 	{
-		block_t *t = b;
-		b = b->next;
-		free(t);
+		uint8_t header[4];
+		uint8_t *data = NULL;
+		long len = 0;
+		if(i < count) {
+			FILE *f = fopen(files[i], "rb");
+			if(f == NULL) {
+				fprintf(stderr, "Failed to open %s\n", files[i]);
+				continue;
+			}
+			fseek(f, 0, SEEK_END);
+			len = ftell(f);
+			fseek(f, 0, SEEK_SET);
+			data = malloc(len);
+			len = fread(data, 1, len, f);
+			fclose(f);
+			sent += 1;
+		} else if(sent == 0) {
+			break;
+		}
+		// the last request (length 0) asks for the statistics
+		put_u32(header, len);
+		if(send(fd, header, 4, MSG_NOSIGNAL) != 4 || send(fd, data, len, MSG_NOSIGNAL) != len) {
+			perror("send");
+			return 1;
+		}
+		free(data);
 	}
-	blockchain = NULL;
 	
-	while(!feof(f))
+	// Print the answers, there is one line for each replay and the statistics.
+	FILE *in = fdopen(fd, "r");
+	char line[512];
+	for(int i = 0; i < (sent + 1) && fgets(line, sizeof(line), in) != NULL; i++) {
+		fputs(line, stdout);
+	}
+	fclose(in);
+	return 0;
+}
+
+int spectateSocket = -1;
+
+/**
+ * Lets viewers connect to a unix socket, see spectate_flush().
+ **/
+bool spectate_listen(const char *path)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	struct sockaddr_un addr = { 0 };
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+	if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SPECTATE_MAX_VIEWERS) < 0) {
+		perror(path);
+		return false;
+	}
+	spectateSocket = fd;
+	spectate.enabled = true;
+	spectate.keyframe = -1;
+	LOG_INFO("Spectators can watch on %s", path);
+	return true;
+}
+
+void spectate_drop(int viewer)
+{
+	close(spectate.viewers[viewer].fd);
+	spectate.viewers[viewer] = spectate.viewers[--spectate.viewerCount];
+}
+
+/**
+ * Sends as much as the socket takes right now. Returns false if the
+ * viewer is gone.
+ **/
+static bool spectate_send(int fd, uint8_t const *data, int len, int *sent)
+{
+	*sent = 0;
+	while(*sent < len) {
+		ssize_t n = send(fd, data + *sent, len - *sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(n < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		*sent += n;
+	}
+	return true;
+}
+
+/**
+ * Accepts new viewers and sends everybody what they don't have yet,
+ * without ever waiting for a viewer. Called once per frame.
+ **/
+void spectate_flush()
+{
+	if(spectate.enabled == false) {
+		return;
+	}
+	
+	int fd;
+	while((fd = accept(spectateSocket, NULL, NULL)) >= 0) {
+		if(spectate.viewerCount >= SPECTATE_MAX_VIEWERS) {
+			close(fd);
+			continue;
+		}
+		spectate_viewer_t *viewer = &spectate.viewers[spectate.viewerCount++];
+		viewer->fd = fd;
+		spectate_join(viewer);
+		LOG_INFO("Spectator %d joined", spectate.viewerCount - 1);
+	}
+	
+	for(int i = 0; i < spectate.viewerCount; i++)
 	{
-		SDL_Rect block;
-		fscanf(f, "%d,%d,%d,%d", &block.x, &block.y, &block.w, &block.h);
-		if(ferror(f)) {
-			fprintf(stderr, "Failed to load level %s\n", file);
-			exit(1);
+		spectate_viewer_t *viewer = &spectate.viewers[i];
+		bool alive = true;
+		int sent;
+		if(viewer->keyframe >= 0) {
+			int len = spectate.keyframeLens[viewer->keyframe] - viewer->keyframeSent;
+			alive = spectate_send(viewer->fd, spectate.keyframes[viewer->keyframe] + viewer->keyframeSent, len, &sent);
+			viewer->keyframeSent += sent;
+			if(sent == len) {
+				viewer->keyframe = SPECTATE_KEYFRAME_SENT;
+			}
+		}
+		if(alive && viewer->keyframe == SPECTATE_KEYFRAME_SENT)
+		{
+			if(spectate.head - viewer->offset > SPECTATE_RING_SIZE) {
+				LOG_WARN("Spectator %d fell too far behind", i);
+				alive = false;
+			}
+			while(alive && viewer->offset < spectate.head) {
+				int start = viewer->offset % SPECTATE_RING_SIZE;
+				int len = MIN(spectate.head - viewer->offset, SPECTATE_RING_SIZE - start);
+				alive = spectate_send(viewer->fd, spectate.ring + start, len, &sent);
+				viewer->offset += sent;
+				if(sent < len) {
+					break;
+				}
+			}
+		}
+		if(alive == false) {
+			LOG_INFO("Spectator %d left", i);
+			spectate_drop(i--);
 		}
-		
-		block_t *b = malloc(sizeof(block_t));
-		b->next = blockchain;
-		b->rect = block;
-		blockchain = b;
 	}
-	fclose(f);
 }
 
-
 /**
- * Spawns a particle in the particle queue.
- */
-void spawn_particle(base_t const * base, int x, int y, float rot)
+ * Watches a game that broadcasts on a unix socket.
+ **/
+int spectate_client(const char *path)
 {
-	particle_t *p = malloc(sizeof(particle_t));
-	p->base = base;
-	p->x = x;
-	p->y = y;
-	p->rotation = rot;
-	p->progress = rand() % 3; // 3 different particle frames
-	p->next = particles;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr = { 0 };
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror(path);
+		return 1;
+	}
 	
-	// Prepend
-	particles = p;
+	static uint8_t input[2 * (2 + SPECTATE_MAX_MESSAGE)];
+	int filled = 0;
+	while(true)
+	{
+		SDL_Event e;
+		while(SDL_PollEvent(&e))
+		{
+			if(e.type == SDL_QUIT) exit(1);
+			if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) {
+				close(fd);
+				return 0;
+			}
+		}
+		
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		while(poll(&pfd, 1, 0) > 0)
+		{
+			ssize_t n = recv(fd, input + filled, sizeof(input) - filled, 0);
+			if(n <= 0) {
+				LOG_INFO("The game ended the spectator stream.");
+				close(fd);
+				return 0;
+			}
+			filled += n;
+			
+			uint8_t const *p = input;
+			while((input + filled - p) >= 2) {
+				uint16_t len;
+				get_u16(p, &len);
+				if(len > SPECTATE_MAX_MESSAGE) {
+					LOG_ERROR("Malformed spectator stream");
+					close(fd);
+					return 1;
+				}
+				if((input + filled - p - 2) < len) {
+					break;
+				}
+				if(spectate_apply(p + 2, len) == false) {
+					LOG_ERROR("Malformed spectator stream");
+					close(fd);
+					return 1;
+				}
+				p += 2 + len;
+			}
+			filled -= p - input;
+			memmove(input, p, filled);
+		}
+		
+		spectate_render();
+		SDL_RenderPresent(renderer);
+	}
 }
 
-void fire_projectile(base_t const * base, float2 pos, float2 vel)
+static void stats_close()
 {
-	projectile_t *p = malloc(sizeof(projectile_t));
-	p->base = base;
-	p->active = true;
-	p->pos = pos;
-	p->vel = vel;
-	p->next = projectiles; 
-	// Prepend
-	projectiles = p;
+	shm_unlink(statsName);
 }
 
-affector_t * create_affector(base_t const * owner, int type, float2 pos)
+bool stats_open(const char *name)
 {
-	affector_t *a = malloc(sizeof(affector_t));
-	a->type = type; /* 0=positive, 1=negative */
-	a->owner = owner;
-	a->center = pos;
-	a->rotation = 0;
-	a->lifepoints = AFFECTOR_LIFE;
-	a->next = affectors;
-	
-	affectors = a;
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if(fd < 0) {
+		perror(name);
+		return false;
+	}
+	if(ftruncate(fd, sizeof(stats_segment_t)) < 0) {
+		perror(name);
+		close(fd);
+		return false;
+	}
+	void *segment = mmap(NULL, sizeof(stats_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(segment == MAP_FAILED) {
+		perror(name);
+		return false;
+	}
 	
-	return a;
+	statsName = name;
+	statsSegment = segment;
+	memset(statsSegment, 0, sizeof(stats_segment_t));
+	statsSegment->magic = STATS_MAGIC;
+	statsSegment->version = STATS_VERSION;
+	statsSegment->size = sizeof(stats_t);
+	statsSegment->pid = getpid();
+	atexit(stats_close);
+	LOG_INFO("Publishing statistics in shared memory %s", name);
+	return true;
 }
 
 /**
- * Loads all resources used by the game.
+ * Prints the statistics of a running game, every interval milliseconds
+ * or once if interval is 0.
  **/
-void load_resources()
+int stats_read(const char *name, int interval)
 {
-#define LOAD(tex, img) if((tex = IMG_LoadTexture(renderer, img)) == NULL) \
-	{ \
-		fprintf(stderr, "Failed to load " img ": %s\n", IMG_GetError()); \
-		exit(1); \
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd < 0) {
+		perror(name);
+		return 1;
 	}
-#define SOUND(snd, file) if((snd = Mix_LoadWAV(file)) == NULL) \
-	{ \
-		fprintf(stderr, "Failed to load " file ": %s\n", Mix_GetError()); \
-		exit(1); \
+	void *mapping = mmap(NULL, sizeof(stats_segment_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) {
+		perror(name);
+		return 1;
 	}
-#define BUTTON(tex, img, imgp) \
-	LOAD(tex[BUTTON_NORMAL],  img "normal" imgp); \
-	LOAD(tex[BUTTON_HOVER],   img "hover" imgp); \
-	LOAD(tex[BUTTON_PRESSED], img "press" imgp)
-	
-	
-	LOAD(texPlayArea, "tex/play-area.png");
-	LOAD(texBase, "tex/base.png");
-	LOAD(texBaseShips, "tex/base-bg.png");
-	LOAD(texNumbers, "tex/numbers.png");
-	LOAD(texMetal, "tex/metalbackground.png");
-	LOAD(texBackPanel, "tex/sidepanel.png");
-	LOAD(texLeftPanel, "tex/left-panel.png");
-	LOAD(texRightPanel, "tex/right-panel.png");
-	LOAD(texParticle, "tex/particles.png");
-	LOAD(texProjectile, "tex/projectile.png");
-	LOAD(texBarricade[0], "tex/barricade-0.png");
-	LOAD(texBarricade[1], "tex/barricade-1.png");
-	LOAD(texBarricade[2], "tex/barricade-2.png");
-	LOAD(texAffector[0], "tex/positive-affector.png");
-	LOAD(texAffector[1], "tex/negative-affector.png");
-	LOAD(texAffector[2], "tex/boost-affector.png");
-	LOAD(texAffector[3], "tex/split3-affector.png");
-	LOAD(texAffector[4], "tex/split2-affector.png");
-	
-	LOAD(texMenuBackground, "tex/mainmenu-bg.png");
-	LOAD(texMenuItems, "tex/mainmenu-items.png");
-	LOAD(texMenuSelector, "tex/mainmenu-selector.png");
-	LOAD(texMenuHelp, "tex/helpmenu.png");
-	
-	LOAD(texCredits, "tex/credits.png");
-	
-	LOAD(texFinalBlue, "tex/winscreen-blue.png");
-	LOAD(texFinalGreen, "tex/winscreen-green.png");
-	
-	LOAD(texLevelBackground, "tex/levelselection.png");
-	LOAD(texLevelSelector, "tex/level-selector.png");
-	LOAD(texLevels[0], "levels/01.png");
-	LOAD(texLevels[1], "levels/02.png");
-	LOAD(texLevels[2], "levels/03.png");
-	LOAD(texLevels[3], "levels/04.png");
-	
-	BUTTON(texButtonLaunch, "tex/launch-button-", ".png");
-	BUTTON(texButtonBack, "tex/back-button-", ".png");
-	
-	SOUND(sndStartup, "sounds/startup.wav");
-	SOUND(sndLaunch, "sounds/launch.wav");
-	SOUND(sndSplit2, "sounds/split2.wav");
-	SOUND(sndSplit3, "sounds/split3.wav");
-	SOUND(sndBoost, "sounds/boost.wav");
-	SOUND(sndImpactBarricade, "sounds/barricade.wav");
-	SOUND(sndImpactWall, "sounds/crush.wav");
-	SOUND(sndImpactBase, "sounds/base.wav");
-	
-#undef BUTTON
-#undef SOUND
-#undef LOAD
-}
-
-
-/*
-struct {
-	bool useSlowAiming;
-	bool affectorsStay;
-	bool rotatingProtectors;
-	int affectorLifespan;
-	int protectorLifespan;
-	int baseLifespan;
-} gameOptions = {
-	useSlowAiming      =  true,
-	affectorsStay      =  true, 
-	rotatingProtectors =  true,
-	affectorLifespan   =  3, // 0-...
-	protectorLifespan  =  3, // 0-3
-	baseLifespan       =  4, // 1-10
-};
-*/
-
-#if defined(_MSC_VER)
-// windows
-
-void load_options();
-
-#else
-// linux
-
-void load_options()
-{
-	dictionary * ini = iniparser_load("game.ini");
-	
-	if(ini == NULL) {
-		fprintf(stderr, "Failed to load game.ini, fallback to default options.\n");
-		return;
+	stats_segment_t const *segment = mapping;
+	if(segment->magic != STATS_MAGIC || segment->version != STATS_VERSION || segment->size != sizeof(stats_t)) {
+		fprintf(stderr, "%s: not a statistics segment of this version\n", name);
+		return 1;
 	}
 	
-	iniparser_dump(ini, stderr);
-	
-	gameOptions.useSlowAiming      = iniparser_getboolean(ini, "iaim:slowaiming", 0);
-	gameOptions.affectorsStay      = iniparser_getboolean(ini, "iaim:affectorsstay", 0);
-	gameOptions.rotatingProtectors = iniparser_getboolean(ini, "iaim:rotatingbarricade", 0);
-	
-	
-	gameOptions.affectorLifespan   = iniparser_getint(ini, "iaim:affectorlifespan", 3);
-	gameOptions.protectorLifespan  = iniparser_getint(ini, "iaim:protectorlifespan", 3);
-	gameOptions.baseLifespan       = iniparser_getint(ini, "iaim:baselifespan", 4);
-	
-	if(gameOptions.affectorLifespan < 1)
-		gameOptions.affectorLifespan = 1;
-	if(gameOptions.protectorLifespan < 0)
-		gameOptions.protectorLifespan = 0;
-	if(gameOptions.protectorLifespan > 3)
-		gameOptions.protectorLifespan = 3;
-	if(gameOptions.baseLifespan < 1)
-		gameOptions.baseLifespan = 1;
-	if(gameOptions.baseLifespan > 10)
-		gameOptions.baseLifespan = 10;
-	
-	iniparser_freedict(ini);
+	while(true) {
+		stats_t s;
+		if(stats_snapshot(segment, &s) == false) {
+			fprintf(stderr, "%s: the game (pid %u) stopped updating the statistics\n", name, segment->pid);
+			return 1;
+		}
+		stats_print(&s);
+		if(interval <= 0) {
+			return 0;
+		}
+		SDL_Delay(interval);
+	}
 }
 
 #endif
@@ -2214,4 +8817,181 @@ bool check_collision(
 		if(hit) return true;
 	}
 	return false;
-}
\ No newline at end of file
+}
+
+#define FX_TRIG_STEPS 4096 // table entries per full turn
+
+static int32_t fxSine[FX_TRIG_STEPS + 1]; // Q30
+
+/**
+ * Builds the sine table of the fixed point simulation. Only uses integer
+ * math, so the table is the same everywhere (libm's sin isn't).
+ **/
+void fx_init()
+{
+	const int64_t halfPi = 1686629713; // pi/2 in Q30
+	
+	// first quadrant from the taylor series
+	for(int i = 0; i <= FX_TRIG_STEPS / 4; i++) {
+		int64_t x = halfPi * i / (FX_TRIG_STEPS / 4);
+		int64_t x2 = (x * x) >> 30;
+		int64_t term = x;
+		int64_t sum = x;
+		for(int n = 2; n < 20; n += 2) {
+			term = -((term * x2) >> 30) / (n * (n + 1));
+			sum += term;
+		}
+		fxSine[i] = sum;
+	}
+	fxSine[FX_TRIG_STEPS / 4] = 1 << 30;
+	
+	// the other quadrants are mirrored
+	for(int i = FX_TRIG_STEPS / 4 + 1; i <= FX_TRIG_STEPS / 2; i++) {
+		fxSine[i] = fxSine[FX_TRIG_STEPS / 2 - i];
+	}
+	for(int i = FX_TRIG_STEPS / 2 + 1; i <= FX_TRIG_STEPS; i++) {
+		fxSine[i] = -fxSine[i - FX_TRIG_STEPS / 2];
+	}
+}
+
+fixed_t fx_sin(fixed_t degrees)
+{
+	// table position in Q16, the table wraps around with the mask
+	const fixed_t tableScale = FX(FX_TRIG_STEPS / 360.0);
+	fixed_t pos = (degrees * tableScale) >> FX_SHIFT;
+	
+	// interpolate linearly between two table entries
+	int i = (pos >> FX_SHIFT) & (FX_TRIG_STEPS - 1);
+	fixed_t f = pos & (FX_ONE - 1);
+	fixed_t s = fxSine[i] + (((fixed_t)(fxSine[i + 1] - fxSine[i]) * f) >> FX_SHIFT);
+	return s >> (30 - FX_SHIFT);
+}
+
+fixed_t fx_cos(fixed_t degrees)
+{
+	return fx_sin(degrees + 90 * FX_ONE);
+}
+
+/**
+ * Returns floor(sqrt(n)). The double square root is only used as a
+ * first guess which is corrected with integer math.
+ **/
+static uint64_t fx_isqrt(uint64_t n)
+{
+	uint64_t r = (uint64_t)sqrt((double)(int64_t)n);
+	while(r * r > n) {
+		r--;
+	}
+	while((r + 1) * (r + 1) <= n) {
+		r++;
+	}
+	return r;
+}
+
+fixed_t fx_length(fixed2 v)
+{
+	uint64_t x = (v.x < 0) ? -v.x : v.x;
+	uint64_t y = (v.y < 0) ? -v.y : v.y;
+	
+	// scale down so the squares can't overflow
+	int shift = 0;
+	while((x | y) >= ((uint64_t)1 << 30)) {
+		x >>= 1;
+		y >>= 1;
+		shift++;
+	}
+	return fx_isqrt(x*x + y*y) << shift;
+}
+
+fixed_t fx_distance(fixed2 a, fixed2 b)
+{
+	return fx_length((fixed2){ a.x - b.x, a.y - b.y });
+}
+
+fixed2 fx_from_float2(float2 v)
+{
+	return (fixed2){ FX(v.x), FX(v.y) };
+}
+
+float2 fx_to_float2(fixed2 v)
+{
+	return (float2){ (float)v.x / FX_ONE, (float)v.y / FX_ONE };
+}
+
+static int fx_orientation(fixed2 p, fixed2 q, fixed2 r)
+{
+	fixed_t val = (q.y - p.y) * (r.x - q.x) -
+	              (q.x - p.x) * (r.y - q.y);
+	if (val == 0) return 0;  // colinear
+	return (val > 0)? 1: 2; // clock or counterclock wise
+}
+
+static bool fx_on_segment(fixed2 p, fixed2 q, fixed2 r)
+{
+	return q.x <= MAX(p.x, r.x) && q.x >= MIN(p.x, r.x) &&
+	       q.y <= MAX(p.y, r.y) && q.y >= MIN(p.y, r.y);
+}
+
+/**
+ * Same as get_line_intersection(), but exact.
+ **/
+static bool fx_line_intersection(
+	fixed2 p1, fixed2 q1,
+	fixed2 p2, fixed2 q2)
+{
+	int o1 = fx_orientation(p1, q1, p2);
+	int o2 = fx_orientation(p1, q1, q2);
+	int o3 = fx_orientation(p2, q2, p1);
+	int o4 = fx_orientation(p2, q2, q1);
+
+	if (o1 != o2 && o3 != o4)
+		return true;
+
+	if (o1 == 0 && fx_on_segment(p1, p2, q1)) return true;
+	if (o2 == 0 && fx_on_segment(p1, q2, q1)) return true;
+	if (o3 == 0 && fx_on_segment(p2, p1, q2)) return true;
+	if (o4 == 0 && fx_on_segment(p2, q1, q2)) return true;
+
+	return false;
+}
+
+bool fx_check_collision(
+	fixed2 start,
+	fixed2 end,
+	fixed2 center,
+	fixed2 size,
+	fixed_t rot)
+{
+	size.x /= 2;
+	size.y /= 2;
+	
+	fixed_t c = FX_ONE;
+	fixed_t s = 0;
+	if(rot != 0) {
+		c = fx_cos(rot);
+		s = fx_sin(rot);
+	}
+	
+	fixed2 points[] = {
+		{ -size.x, -size.y }, // top-left
+		{  size.x, -size.y }, // top-right
+		{  size.x,  size.y }, // bottom-right
+		{ -size.x,  size.y }, // bottom-left
+	};
+	for(int i = 0; i < 4; i++) {
+		fixed2 np = {
+			FX_MUL(points[i].x, c) - FX_MUL(points[i].y, s),
+			FX_MUL(points[i].x, s) + FX_MUL(points[i].y, c),
+		};
+		points[i].x = center.x + np.x + size.x;
+		points[i].y = center.y + np.y + size.y;
+	}
+	
+	for(int i = 0; i < 4; i++) {
+		bool hit = fx_line_intersection(
+			points[i], points[(i+1)%4],
+			start, end);
+		if(hit) return true;
+	}
+	return false;
+}